@@ -0,0 +1,37 @@
+// the render hot path must not touch the heap, see allocations.h
+#include "objects.h"
+#include "render_settings.h"
+#include "allocations.h"
+#include "bench.h"
+#include <random>
+#include <cstdio>
+
+bool verify_allocations()
+{
+	if (!allocations::tracked) {
+		printf("allocation check: counting not compiled in (SOL_ALLOC_COUNT), skipped\n");
+		return true;
+	}
+
+	auto mt = std::mt19937_64(5);
+	auto objects = random_objects(10000, mt);
+	auto c = camera{ 640, 360 };
+	c.reposition({ -12, .5f, .3f }, { 0, 0, 0 }, { 0, 1, 0 });
+	auto settings = render_settings{};
+	settings.shadow_samples = 4;
+
+	auto ok = true;
+	const intersect_kernels* kernel_sets[] = { &scalar_kernels(), &best_kernels() };
+	for (auto kernels : kernel_sets) {
+		for (auto half_edges : { false, true }) {
+			auto lights = std::vector<light>{ light{ pos{ -8, 8, -8 }, rgb{ 1,1,1 } }, light{ pos{ 8, 8, 8 }, rgb{ 1,1,1 } } };
+			auto s = scene{ objects, std::move(lights), false, *kernels };
+			if (half_edges) s.store_half_edges();
+			const auto n = hot_path_allocations(s, c, { 640, 360 }, settings, 1);
+			printf("allocation check: %s kernels%s: %llu heap allocations -> %s\n", kernels->name, half_edges ? ", half edges" : "",
+				static_cast<unsigned long long>(n), n == 0 ? "ok" : "FAILED");
+			ok = ok && n == 0;
+		}
+	}
+	return ok;
+}
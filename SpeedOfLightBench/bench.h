@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <utility>
+#include <initializer_list>
+
+class object;
+
+// Every measurement also goes in here, so a run can be saved as json
+// (--json path) and compared against an earlier one.
+class bench_report
+{
+public:
+	void add(const char* group, const std::string& name, std::initializer_list<std::pair<const char*, double>> values);
+	bool write_json(const char* path) const;
+
+private:
+	struct entry {
+		std::string group;
+		std::string name;
+		std::vector<std::pair<std::string, double>> values;
+	};
+	std::vector<entry> entries;
+};
+
+struct genvec_kernel
+{
+	const char* name;
+	// returns the seconds spent doing reps passes over n vectors
+	double(*run)(size_t n, size_t reps, float& checksum);
+};
+
+// genvec_kernels.inl compiled against each flavour of genvec
+namespace genvec_simd_bench {
+	extern const genvec_kernel kernels[];
+	extern const size_t kernel_count;
+}
+
+namespace genvec_fast_bench {
+	extern const genvec_kernel kernels[];
+	extern const size_t kernel_count;
+}
+
+namespace genvec_scalar_bench {
+	extern const genvec_kernel kernels[];
+	extern const size_t kernel_count;
+}
+
+// kernel_bench.cpp: scalar vs wide intersection kernels
+bool verify_kernels();
+void bench_kernels(bench_report& report);
+
+// object_bench.cpp: the objects.h intersection code and sphere sampling
+void bench_objects(bench_report& report);
+
+// packet_bench.cpp: single primary rays vs packets
+bool bench_packets(bench_report& report);
+
+// alloc_bench.cpp: no heap allocations while tracing rays
+bool verify_allocations();
+
+// render_bench.cpp: whole renders of random scenes of every size up to
+// max_prims, then a thread sweep from 1 to max_threads on the 10k scene
+void bench_render(bench_report& report, size_t max_prims, int max_threads);
+
+// n small spheres and triangles scattered through [-5, 5]^3
+std::vector<std::shared_ptr<object>> random_objects(size_t n, std::mt19937_64& mt);
@@ -0,0 +1,10 @@
+// the SSE specializations with the rsqrt normalize opted in
+#define GENVEC_FAST_NORMALIZE
+#define genvec genvec_fast
+#include "genvec.h"
+#undef genvec
+namespace genvec = genvec_fast;
+#include "bench.h"
+
+#define BENCH_NS genvec_fast_bench
+#include "genvec_kernels.inl"
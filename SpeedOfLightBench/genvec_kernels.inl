@@ -0,0 +1,100 @@
+// The genvec operator microbenchmarks. Included once per genvec flavour with
+// BENCH_NS naming the namespace the kernels end up in.
+
+#include <chrono>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+namespace BENCH_NS {
+	using genvec::fvec3;
+	using genvec::dot;
+	using genvec::cross;
+
+	namespace {
+		auto make_data(size_t n, uint64_t seed) {
+			auto mt = std::mt19937_64(seed);
+			auto d = std::uniform_real_distribution<float>(-1, 1);
+			auto v = std::vector<fvec3>();
+			v.reserve(n);
+			for (size_t i = 0; i < n; i++) {
+				auto x = d(mt);
+				auto y = d(mt);
+				auto z = d(mt);
+				v.push_back(fvec3{ x, y, z });
+			}
+			return v;
+		}
+
+		template<typename F>
+		double time_kernel(size_t n, size_t reps, float& checksum, F&& kernel) {
+			const auto a = make_data(n, 1);
+			const auto b = make_data(n, 2);
+			auto out = make_data(n, 3);
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (size_t r = 0; r < reps; r++) {
+				for (size_t i = 0; i < n; i++) {
+					kernel(a[i], b[i], out[i]);
+				}
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			checksum = 0;
+			for (const auto& v : out) {
+				checksum += v.sum();
+			}
+			return std::chrono::duration<double>(end - start).count();
+		}
+
+		double add_mul(size_t n, size_t reps, float& checksum) {
+			return time_kernel(n, reps, checksum, [](const fvec3& a, const fvec3& b, fvec3& out) {
+				out = (a * b + out) * .5f;
+			});
+		}
+
+		double dot_product(size_t n, size_t reps, float& checksum) {
+			return time_kernel(n, reps, checksum, [](const fvec3& a, const fvec3& b, fvec3& out) {
+				out = out * .5f + a * dot(a, b);
+			});
+		}
+
+		double cross_product(size_t n, size_t reps, float& checksum) {
+			return time_kernel(n, reps, checksum, [](const fvec3& a, const fvec3& b, fvec3& out) {
+				out = cross(a, b) + out * .5f;
+			});
+		}
+
+		double normalize(size_t n, size_t reps, float& checksum) {
+			return time_kernel(n, reps, checksum, [](const fvec3& a, const fvec3& b, fvec3& out) {
+				out = (a + b + out).normalized();
+			});
+		}
+
+		// the blinn-phong term from intersect_scene
+		double shade(size_t n, size_t reps, float& checksum) {
+			return time_kernel(n, reps, checksum, [](const fvec3& a, const fvec3& b, fvec3& out) {
+				const auto light_pos = fvec3{ 3, 3, 3 };
+				const auto diff = fvec3{ 1, 0, 0 };
+				const auto spec = fvec3{ .1f, .1f, .1f };
+				auto norm = a.normalized();
+				auto v = b * (-1.f);
+				auto l = (light_pos - a).normalized();
+				auto h = (v + l).normalized();
+				auto diffuse = diff * std::max(0.f, dot(norm, l));
+				auto specular = spec * std::pow(std::max(0.f, dot(norm, h)), 20.f);
+				out = out * .5f + (diffuse.abs() + specular.abs()) / 100;
+			});
+		}
+	}
+
+	extern const genvec_kernel kernels[] = {
+		{ "add/mul", add_mul },
+		{ "dot", dot_product },
+		{ "cross", cross_product },
+		{ "normalize", normalize },
+		{ "shade", shade },
+	};
+
+	extern const size_t kernel_count = sizeof(kernels) / sizeof(kernels[0]);
+}
@@ -0,0 +1,10 @@
+// the generic template, renamed so it can live next to the SSE version
+#define GENVEC_NO_SIMD
+#define genvec genvec_scalar
+#include "genvec.h"
+#undef genvec
+namespace genvec = genvec_scalar;
+#include "bench.h"
+
+#define BENCH_NS genvec_scalar_bench
+#include "genvec_kernels.inl"
@@ -0,0 +1,5 @@
+#include "genvec.h"
+#include "bench.h"
+
+#define BENCH_NS genvec_simd_bench
+#include "genvec_kernels.inl"
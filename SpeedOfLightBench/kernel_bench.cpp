@@ -0,0 +1,160 @@
+// checks the wide intersection kernels against the scalar ones, then times them
+#include "kernels.h"
+#include "objects.h"
+#include "bench.h"
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace {
+	struct test_rays {
+		std::vector<flat_ray> rays;
+		std::vector<ray> full;
+	};
+
+	test_rays make_rays(size_t n, std::mt19937_64& mt) {
+		auto d = std::uniform_real_distribution<float>(-1, 1);
+		auto out = test_rays{};
+		for (size_t i = 0; i < n; i++) {
+			auto o = pos{ d(mt) * 4, d(mt) * 4, d(mt) * 4 };
+			auto dir = fvec3{ d(mt), d(mt), d(mt) };
+			auto r = ray{ o, dir };
+			out.full.push_back(r);
+			out.rays.push_back(flat_ray{ r });
+		}
+		return out;
+	}
+
+	// builds both the flat arrays and the reference objects for them
+	struct test_scene {
+		sphere_soa spheres;
+		triangle_soa triangles;
+		std::vector<std::shared_ptr<object>> sphere_objects;
+		std::vector<std::shared_ptr<object>> triangle_objects;
+	};
+
+	test_scene make_scene(size_t n, std::mt19937_64& mt) {
+		auto d = std::uniform_real_distribution<float>(-3, 3);
+		auto small = std::uniform_real_distribution<float>(-1, 1);
+		auto out = test_scene{};
+		for (size_t i = 0; i < n; i++) {
+			auto c = pos{ d(mt), d(mt), d(mt) };
+			auto radius = .2f + std::abs(small(mt));
+			out.spheres.cx.push_back(c[0]);
+			out.spheres.cy.push_back(c[1]);
+			out.spheres.cz.push_back(c[2]);
+			out.spheres.rsq.push_back(radius * radius);
+			out.spheres.mat.push_back(0);
+			out.sphere_objects.push_back(make_sphere(c, radius));
+
+			auto a = pos{ d(mt), d(mt), d(mt) };
+			auto b = a + fvec3{ small(mt), small(mt), small(mt) } * 2;
+			auto cc = a + fvec3{ small(mt), small(mt), small(mt) } * 2;
+			auto e1 = b - a;
+			auto e2 = cc - a;
+			auto& t = out.triangles;
+			t.ax.push_back(a[0]); t.ay.push_back(a[1]); t.az.push_back(a[2]);
+			t.e1x.push_back(e1[0]); t.e1y.push_back(e1[1]); t.e1z.push_back(e1[2]);
+			t.e2x.push_back(e2[0]); t.e2y.push_back(e2[1]); t.e2z.push_back(e2[2]);
+			t.n.push_back(0);
+			t.mat.push_back(0);
+			out.triangle_objects.push_back(make_triangle(a, b, cc));
+		}
+		return out;
+	}
+
+	// nearest hit over objects[first, first + count) with the original object code
+	float reference_closest(const std::vector<std::shared_ptr<object>>& objects, uint32_t first, uint32_t count, const ray& r) {
+		auto tmax = std::numeric_limits<float>::infinity();
+		for (auto i = first; i < first + count; i++) {
+			auto hit = objects[i]->intersect(r);
+			if (hit.valid && hit.d < tmax)
+				tmax = hit.d;
+		}
+		return tmax;
+	}
+
+	bool close_enough(float a, float b) {
+		if (std::isinf(a) || std::isinf(b)) return a == b;
+		return std::abs(a - b) <= 1e-3f * std::max(1.f, std::abs(a));
+	}
+}
+
+bool verify_kernels()
+{
+	auto mt = std::mt19937_64(42);
+	auto s = make_scene(64, mt);
+	auto rays = make_rays(20000, mt);
+
+	const auto& scalar = scalar_kernels();
+	const auto& wide = best_kernels();
+
+	auto checks = size_t{ 0 };
+	auto scalar_vs_reference = size_t{ 0 };
+	auto wide_vs_scalar = size_t{ 0 };
+
+	// odd range sizes so the masked tail of the wide kernels is exercised
+	const uint32_t ranges[][2] = { { 0, 1 }, { 3, 5 }, { 8, 8 }, { 11, 13 }, { 0, 64 } };
+	for (size_t ri = 0; ri < rays.rays.size(); ri++) {
+		const auto& fr = rays.rays[ri];
+		const auto& r = rays.full[ri];
+		for (const auto& range : ranges) {
+			const auto first = range[0], count = range[1];
+			const auto inf = std::numeric_limits<float>::infinity();
+			checks += 2;
+
+			auto ss = no_hit, ws = no_hit;
+			auto scalar_sphere = scalar.sphere_closest(s.spheres, first, count, fr, inf, ss);
+			auto wide_sphere = wide.sphere_closest(s.spheres, first, count, fr, inf, ws);
+			if (!close_enough(scalar_sphere, reference_closest(s.sphere_objects, first, count, r))) scalar_vs_reference++;
+			if (!close_enough(scalar_sphere, wide_sphere)) wide_vs_scalar++;
+			if (scalar.sphere_any(s.spheres, first, count, fr, scalar_sphere * 1.01f) != wide.sphere_any(s.spheres, first, count, fr, scalar_sphere * 1.01f)) wide_vs_scalar++;
+
+			auto st = no_hit, wt = no_hit;
+			auto scalar_tri = scalar.triangle_closest(s.triangles, first, count, fr, inf, st);
+			auto wide_tri = wide.triangle_closest(s.triangles, first, count, fr, inf, wt);
+			if (!close_enough(scalar_tri, reference_closest(s.triangle_objects, first, count, r))) scalar_vs_reference++;
+			if (!close_enough(scalar_tri, wide_tri)) wide_vs_scalar++;
+			if (scalar.triangle_any(s.triangles, first, count, fr, scalar_tri * 1.01f) != wide.triangle_any(s.triangles, first, count, fr, scalar_tri * 1.01f)) wide_vs_scalar++;
+		}
+	}
+
+	// ray/edge grazing cases may round differently, anything past that is a bug
+	const auto allowed = checks / 10000;
+	auto ok = scalar_vs_reference <= allowed && wide_vs_scalar <= allowed;
+	printf("kernel check: %zu queries, scalar vs objects.h: %zu, %s vs scalar: %zu -> %s\n",
+		checks, scalar_vs_reference, wide.name, wide_vs_scalar, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+void bench_kernels(bench_report& report)
+{
+	auto mt = std::mt19937_64(7);
+	auto s = make_scene(1024, mt);
+	auto rays = make_rays(1 << 12, mt);
+
+	const intersect_kernels* kernel_sets[] = { &scalar_kernels(), &best_kernels() };
+	printf("%-10s %16s %16s %16s %16s\n", "kernels", "sphere Mtests/s", "sphere any", "tri Mtests/s", "tri any");
+	for (auto k : kernel_sets) {
+		auto run = [&](auto&& f) {
+			auto start = std::chrono::high_resolution_clock::now();
+			auto sink = 0.f;
+			for (const auto& r : rays.rays) {
+				sink += f(r);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			auto tests = static_cast<double>(rays.rays.size()) * 1024;
+			return (sink == -1 ? 0 : tests) / std::chrono::duration<double>(end - start).count() / 1e6;
+		};
+		const auto inf = std::numeric_limits<float>::infinity();
+		auto sc = run([&](const flat_ray& r) { uint32_t h = no_hit; return k->sphere_closest(s.spheres, 0, 1024, r, inf, h); });
+		auto sa = run([&](const flat_ray& r) { return k->sphere_any(s.spheres, 0, 1024, r, -1.f) ? 1.f : 0.f; });
+		auto tc = run([&](const flat_ray& r) { uint32_t h = no_hit; return k->triangle_closest(s.triangles, 0, 1024, r, inf, h); });
+		auto ta = run([&](const flat_ray& r) { return k->triangle_any(s.triangles, 0, 1024, r, -1.f) ? 1.f : 0.f; });
+		printf("%-10s %16.1f %16.1f %16.1f %16.1f\n", k->name, sc, sa, tc, ta);
+		report.add("kernels", k->name, { { "sphere_closest_mtests_per_s", sc }, { "sphere_any_mtests_per_s", sa }, { "triangle_closest_mtests_per_s", tc }, { "triangle_any_mtests_per_s", ta } });
+	}
+}
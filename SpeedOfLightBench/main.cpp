@@ -0,0 +1,77 @@
+// SpeedOfLightBench.cpp : microbenchmarks for the ray tracer's hot paths.
+//
+
+#include "genvec.h"
+#include "bench.h"
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+
+namespace {
+	void bench_genvec(bench_report& report) {
+		const size_t n = 1 << 12;
+		const size_t reps = 2000;
+		const auto ops = static_cast<double>(n * reps);
+
+		if (sizeof(genvec::fvec3) != 4 * sizeof(float))
+			printf("note: genvec SIMD specializations are not enabled for this target\n");
+
+		printf("%-12s %12s %12s %12s %9s %9s\n", "genvec", "generic ns", "sse ns", "sse+rsqrt ns", "speedup", "rsqrt");
+		for (size_t k = 0; k < genvec_scalar_bench::kernel_count; k++) {
+			float scalar_sum, simd_sum, fast_sum;
+			auto scalar = genvec_scalar_bench::kernels[k].run(n, reps, scalar_sum);
+			auto simd = genvec_simd_bench::kernels[k].run(n, reps, simd_sum);
+			auto fast = genvec_fast_bench::kernels[k].run(n, reps, fast_sum);
+
+			// fp contraction and reassociation differ between the flavours
+			auto tolerance = 1e-3f * std::max(1.f, std::abs(scalar_sum));
+			if (std::abs(scalar_sum - simd_sum) > tolerance)
+				printf("%s: sse result %f does not match generic %f\n", genvec_scalar_bench::kernels[k].name, simd_sum, scalar_sum);
+
+			printf("%-12s %12.3f %12.3f %12.3f %8.2fx %8.2fx\n", genvec_scalar_bench::kernels[k].name,
+				scalar * 1e9 / ops, simd * 1e9 / ops, fast * 1e9 / ops, scalar / simd, scalar / fast);
+			report.add("genvec", genvec_scalar_bench::kernels[k].name, { { "generic_ns", scalar * 1e9 / ops }, { "sse_ns", simd * 1e9 / ops }, { "sse_rsqrt_ns", fast * 1e9 / ops } });
+		}
+	}
+}
+
+// --json path       also write every result there
+// --max-prims n     skip the render scenes above n primitives (default 1000000)
+// --threads n       most threads for the renders and the sweep (default all)
+int main(int argc, char* argv[])
+{
+	const char* json = nullptr;
+	auto max_prims = size_t{ 1000000 };
+	auto max_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	for (auto i = 1; i < argc; i++) {
+		auto has_value = i + 1 < argc;
+		if (!strcmp(argv[i], "--json") && has_value) json = argv[++i];
+		if (!strcmp(argv[i], "--max-prims") && has_value) max_prims = static_cast<size_t>(std::max(0, atoi(argv[++i])));
+		if (!strcmp(argv[i], "--threads") && has_value) max_threads = std::max(1, atoi(argv[++i]));
+	}
+
+	auto report = bench_report{};
+	bench_genvec(report);
+	printf("\n");
+	bench_objects(report);
+	printf("\n");
+	if (!verify_kernels())
+		return 1;
+	bench_kernels(report);
+	printf("\n");
+	if (!bench_packets(report))
+		return 1;
+	printf("\n");
+	if (!verify_allocations())
+		return 1;
+	printf("\n");
+	bench_render(report, max_prims, max_threads);
+
+	if (json && !report.write_json(json)) {
+		printf("could not write %s\n", json);
+		return 1;
+	}
+}
@@ -0,0 +1,82 @@
+// the original per object intersection code and the sphere sampling, per call
+#include "objects.h"
+#include "randutils.h"
+#include "bench.h"
+#include <random>
+#include <chrono>
+#include <cstdio>
+
+namespace {
+	template<typename F>
+	double ns_per_call(size_t calls, F&& f) {
+		auto start = std::chrono::high_resolution_clock::now();
+		f();
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double>(end - start).count() * 1e9 / calls;
+	}
+}
+
+void bench_objects(bench_report& report)
+{
+	auto mt = std::mt19937_64(11);
+	auto d = std::uniform_real_distribution<float>(-1, 1);
+	const size_t n = 256, ray_count = 4096;
+
+	auto spheres = std::vector<std::shared_ptr<object>>();
+	auto triangles = std::vector<std::shared_ptr<object>>();
+	for (size_t i = 0; i < n; i++) {
+		auto c = pos{ d(mt) * 3, d(mt) * 3, d(mt) * 3 };
+		spheres.push_back(make_sphere(c, .2f + std::abs(d(mt))));
+		triangles.push_back(make_triangle(c, c + fvec3{ d(mt), d(mt), d(mt) } * 2, c + fvec3{ d(mt), d(mt), d(mt) } * 2));
+	}
+	auto rays = std::vector<ray>();
+	for (size_t i = 0; i < ray_count; i++) {
+		rays.push_back(ray{ pos{ d(mt) * 4, d(mt) * 4, d(mt) * 4 }, fvec3{ d(mt), d(mt), d(mt) } });
+	}
+
+	// sinks keep the optimizer from dropping the calls
+	auto hits = size_t{ 0 };
+	auto sum = 0.f;
+	auto bench_intersect = [&](const std::vector<std::shared_ptr<object>>& objects) {
+		return ns_per_call(n * ray_count, [&]() {
+			for (const auto& r : rays)
+				for (const auto& o : objects)
+					hits += o->intersect(r).valid;
+		});
+	};
+	auto bench_occludes = [&](const std::vector<std::shared_ptr<object>>& objects) {
+		return ns_per_call(n * ray_count, [&]() {
+			for (const auto& r : rays)
+				for (const auto& o : objects)
+					hits += o->occludes(r, 5.f);
+		});
+	};
+
+	const auto sphere_intersect = bench_intersect(spheres);
+	const auto sphere_occludes = bench_occludes(spheres);
+	// triangle::hit_test is private, intersect is hit_test plus the normal
+	const auto triangle_intersect = bench_intersect(triangles);
+	const auto triangle_occludes = bench_occludes(triangles);
+
+	auto rng = randutils::pcg32{ 5 };
+	const size_t points = 1 << 22;
+	const auto on_sphere = ns_per_call(points, [&]() {
+		for (size_t i = 0; i < points; i++)
+			sum += random_point_on_sphere<float>(rng)[0];
+	});
+
+	printf("%-28s %10s\n", "objects.h", "ns/call");
+	printf("%-28s %10.2f\n", "sphere::intersect", sphere_intersect);
+	printf("%-28s %10.2f\n", "sphere::occludes", sphere_occludes);
+	printf("%-28s %10.2f\n", "triangle::intersect", triangle_intersect);
+	printf("%-28s %10.2f\n", "triangle::occludes", triangle_occludes);
+	printf("%-28s %10.2f\n", "random_point_on_sphere", on_sphere);
+	if (hits == 0 || sum == 12345.f)
+		printf("(sink %zu %f)\n", hits, sum);
+
+	report.add("objects", "sphere::intersect", { { "ns_per_call", sphere_intersect } });
+	report.add("objects", "sphere::occludes", { { "ns_per_call", sphere_occludes } });
+	report.add("objects", "triangle::intersect", { { "ns_per_call", triangle_intersect } });
+	report.add("objects", "triangle::occludes", { { "ns_per_call", triangle_occludes } });
+	report.add("objects", "random_point_on_sphere", { { "ns_per_call", on_sphere } });
+}
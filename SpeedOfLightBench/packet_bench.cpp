@@ -0,0 +1,75 @@
+// primary visibility, one ray at a time against 8x8 packets
+#include "objects.h"
+#include "bench.h"
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+	// -1 for a miss
+	float distance(const std::pair<material const*, intersection>& hit) {
+		return hit.first ? hit.second.d : -1.f;
+	}
+
+	template<typename F>
+	double seconds(F&& f) {
+		auto start = std::chrono::high_resolution_clock::now();
+		f();
+		return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+}
+
+bool bench_packets(bench_report& report)
+{
+	const auto width = 1920, height = 1080;
+	auto mt = std::mt19937_64(3);
+	auto ok = true;
+
+	printf("%-10s %14s %14s %9s\n", "prims", "single Mray/s", "packet Mray/s", "speedup");
+	for (auto n : { 100, 10000, 100000 }) {
+		auto s = scene{ random_objects(n, mt), {}, false };
+		auto c = camera{ width, height };
+		c.reposition({ -12, .5f, .3f }, { 0, 0, 0 }, { 0, 1, 0 });
+
+		auto single = std::vector<float>(width * height);
+		auto packed = std::vector<float>(width * height);
+
+		auto single_time = seconds([&]() {
+			for (auto y = 0; y < height; y++)
+				for (auto x = 0; x < width; x++)
+					single[y * width + x] = distance(s.closest_hit(c.castRay(x, y)));
+		});
+
+		auto packet_time = seconds([&]() {
+			ray_packet p;
+			std::pair<material const*, intersection> hits[ray_packet::size];
+			for (auto y0 = 0; y0 < height; y0 += ray_packet::dim) {
+				for (auto x0 = 0; x0 < width; x0 += ray_packet::dim) {
+					c.castPacket(x0, y0, p);
+					s.closest_hit(p, hits);
+					for (auto y = 0; y < p.height; y++)
+						for (auto x = 0; x < p.width; x++)
+							packed[(y0 + y) * width + x0 + x] = distance(hits[y * ray_packet::dim + x]);
+				}
+			}
+		});
+
+		auto mismatches = 0;
+		for (size_t i = 0; i < single.size(); i++) {
+			auto a = single[i], b = packed[i];
+			if ((a < 0) != (b < 0) || std::abs(a - b) > 1e-3f * std::max(1.f, a))
+				mismatches++;
+		}
+		if (mismatches > width * height / 10000) {
+			printf("%d primary rays differ between single rays and packets\n", mismatches);
+			ok = false;
+		}
+
+		const auto rays = static_cast<double>(width * height);
+		printf("%-10d %14.2f %14.2f %8.2fx\n", n, rays / single_time / 1e6, rays / packet_time / 1e6, single_time / packet_time);
+		report.add("packets", std::to_string(n) + " prims", { { "single_mrays_per_s", rays / single_time / 1e6 }, { "packet_mrays_per_s", rays / packet_time / 1e6 } });
+	}
+	return ok;
+}
@@ -0,0 +1,120 @@
+// whole renders of random scenes: rays per second by scene size and thread count
+#include "objects.h"
+#include "integrator.h"
+#include "scheduler.h"
+#include "sampler.h"
+#include "bench.h"
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <mutex>
+#include <string>
+
+namespace {
+	const auto width = 640, height = 360;
+
+	struct render_result {
+		double seconds;
+		ray_counts counts;
+	};
+
+	uint64_t total(const uint64_t (&per_depth)[ray_counts::depths]) {
+		auto sum = uint64_t{ 0 };
+		for (auto n : per_depth) sum += n;
+		return sum;
+	}
+
+	// one frame the way main renders it without packets
+	render_result render(const scene& s, camera& c, const render_settings& settings, int threads) {
+		const auto size = genvec::ivec2{ width, height };
+		tile_scheduler scheduler(size, 32, threads);
+		scheduler.quiet = true;
+
+		struct worker_state {
+			sampler smp;
+			ray_counts counts;
+		};
+		auto result = render_result{ 0, {} };
+		std::mutex lock;
+		auto sink = std::vector<float>(width * height);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		scheduler.run([&]() { return worker_state{ sampler{ settings.pattern, 1 } }; }, [&](const tile& t, worker_state& w) {
+			for (auto y = t.y0; y < t.y0 + t.height; y++) {
+				for (auto x = t.x0; x < t.x0 + t.width; x++) {
+					w.smp.start_pixel(x, y);
+					sink[y * width + x] = trace_path(s, c.castRay(x, y), settings, w.smp, w.counts)[0];
+				}
+			}
+		}, [&](worker_state& w) {
+			std::lock_guard<std::mutex> guard(lock);
+			result.counts += w.counts;
+		});
+		result.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		return result;
+	}
+
+	scene make_scene(size_t n) {
+		auto mt = std::mt19937_64(17);
+		auto lights = std::vector<light>{ light{ pos{ -8, 8, -8 }, rgb{ 1,1,1 } }, light{ pos{ 8, 8, 8 }, rgb{ 1,1,1 } } };
+		return scene{ random_objects(n, mt), std::move(lights), false };
+	}
+
+	// fixed shadow ray counts, so the work per hit does not depend on the noise
+	render_settings bench_settings() {
+		auto settings = render_settings{};
+		settings.shadow_samples = 8;
+		settings.shadow_min_samples = 8;
+		settings.shadow_variance = 0;
+		return settings;
+	}
+}
+
+std::vector<std::shared_ptr<object>> random_objects(size_t n, std::mt19937_64& mt)
+{
+	auto d = std::uniform_real_distribution<float>(-5, 5);
+	auto small = std::uniform_real_distribution<float>(-.3f, .3f);
+	auto objects = std::vector<std::shared_ptr<object>>();
+	for (size_t i = 0; i < n; i++) {
+		auto c = pos{ d(mt), d(mt), d(mt) };
+		if (i % 2)
+			objects.push_back(make_sphere(c, .05f + std::abs(small(mt)) * .3f));
+		else
+			objects.push_back(make_triangle(c, c + fvec3{ small(mt), small(mt), small(mt) }, c + fvec3{ small(mt), small(mt), small(mt) }));
+	}
+	return objects;
+}
+
+void bench_render(bench_report& report, size_t max_prims, int max_threads)
+{
+	const auto settings = bench_settings();
+	auto c = camera{ width, height };
+	c.reposition({ -12, .5f, .3f }, { 0, 0, 0 }, { 0, 1, 0 });
+
+	printf("%-10s %10s %14s %14s %14s\n", "prims", "seconds", "primary Mray/s", "shadow Mray/s", "total Mray/s");
+	for (size_t n : { 1, 100, 10000, 1000000 }) {
+		if (n > max_prims) break;
+		const auto s = make_scene(n);
+		const auto r = render(s, c, settings, max_threads);
+		const auto primary = r.counts.paths[0] / r.seconds / 1e6;
+		const auto shadow = total(r.counts.shadows) / r.seconds / 1e6;
+		const auto all = (total(r.counts.paths) + total(r.counts.shadows)) / r.seconds / 1e6;
+		printf("%-10zu %10.3f %14.2f %14.2f %14.2f\n", n, r.seconds, primary, shadow, all);
+		report.add("render", std::to_string(n) + " prims", { { "threads", max_threads }, { "seconds", r.seconds },
+			{ "primary_mrays_per_s", primary }, { "shadow_mrays_per_s", shadow }, { "total_mrays_per_s", all } });
+	}
+	printf("\n");
+
+	// 1, 2, 4, ... and max_threads itself
+	const auto s = make_scene(10000);
+	auto base = 0.;
+	printf("%-10s %10s %14s %9s %11s\n", "threads", "seconds", "total Mray/s", "speedup", "efficiency");
+	for (auto t = 1; t <= max_threads; t = (t * 2 > max_threads && t != max_threads) ? max_threads : t * 2) {
+		const auto r = render(s, c, settings, t);
+		const auto all = (total(r.counts.paths) + total(r.counts.shadows)) / r.seconds / 1e6;
+		if (t == 1) base = r.seconds;
+		printf("%-10d %10.3f %14.2f %8.2fx %10.0f%%\n", t, r.seconds, all, base / r.seconds, 100 * base / r.seconds / t);
+		report.add("threads", std::to_string(t) + " threads", { { "threads", t }, { "seconds", r.seconds },
+			{ "total_mrays_per_s", all }, { "speedup", base / r.seconds } });
+	}
+}
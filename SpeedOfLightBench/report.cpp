@@ -0,0 +1,37 @@
+// json output for bench_report
+#include "bench.h"
+#include <fstream>
+#include <cmath>
+
+void bench_report::add(const char* group, const std::string& name, std::initializer_list<std::pair<const char*, double>> values)
+{
+	auto e = entry{ group, name, {} };
+	for (const auto& v : values) {
+		e.values.emplace_back(v.first, v.second);
+	}
+	entries.push_back(std::move(e));
+}
+
+bool bench_report::write_json(const char* path) const
+{
+	auto out = std::ofstream(path);
+	if (!out) return false;
+
+	// names are ours, nothing in them needs escaping
+	out << "{\n  \"results\": [\n";
+	for (size_t i = 0; i < entries.size(); i++) {
+		const auto& e = entries[i];
+		out << "    { \"group\": \"" << e.group << "\", \"name\": \"" << e.name << "\"";
+		for (const auto& v : e.values) {
+			out << ", \"" << v.first << "\": ";
+			// json has no inf or nan
+			if (std::isfinite(v.second))
+				out << v.second;
+			else
+				out << "null";
+		}
+		out << " }" << (i + 1 < entries.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+	return static_cast<bool>(out);
+}
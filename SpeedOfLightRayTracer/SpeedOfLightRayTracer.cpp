@@ -9,6 +9,25 @@
 #include "intersection.h"
 #include "objects.h"
 #include "randutils.h"
+#include "scene.h"
+#include "wavefront.h"
+#include "integrator.h"
+#include "render_settings.h"
+#include "scheduler.h"
+#include "supersample.h"
+#include "denoise.h"
+#include "progressive.h"
+#include "profiler.h"
+#include "heatmap.h"
+#include "convergence.h"
+#include "mesh.h"
+#include "scene_file.h"
+#include "allocations.h"
+#include <cstring>
+#include <cstdlib>
+#include <mutex>
+#include <atomic>
+#include <csignal>
 
 using namespace genvec;
 using std::unique_ptr;
@@ -24,7 +43,6 @@ using std::pair;
 using std::make_pair;
 
 using object_ptr = shared_ptr<object>;
-using scene = pair<vector<object_ptr>, vector<light>>;
 
 auto load_scene() {
     return make_pair(
@@ -49,125 +67,297 @@ auto load_scene() {
     );
 }
 
-auto get_closest_intersection(const scene& scene, const ray& r) {
-    object const* closest_object = nullptr;
-    intersection closest_intersection;
-
-    for (const auto& obj : scene.first) {
-        auto intersect = obj->intersect(r);
+// tone maps by the brightest pixel into imgscaled and writes a ppm; the
+// caller keeps imgscaled, so snapshots of one render reuse it
+void write_image(const char* path, const vector<rgb>& img, const ivec2& size, vector<bvec<3>>& imgscaled) {
+    imgscaled.resize(size[0] * size[1]);
+    {
+        PROFILE_SCOPE("tone map");
+        auto max = img[0].len();
+        for (auto& col : img) {
+            max = std::max(max, col.len());
+        }
 
-        if (intersect.valid && (!closest_object || closest_intersection.d > intersect.d)) {
-            closest_object = obj.get();
-            closest_intersection = intersect;
+        for (int i = 0; i < size[0] * size[1]; ++i) {
+            auto red = static_cast<uint8_t>(img[i][0] / max * 0xFF);
+            auto gre = static_cast<uint8_t>(img[i][1] / max * 0xFF);
+            auto blu = static_cast<uint8_t>(img[i][2] / max * 0xFF);
+            auto alp = static_cast<uint8_t>(0xFF);
+            imgscaled[i] = { red, gre, blu };
         }
     }
 
-    return make_pair(closest_object, closest_intersection);
+    PROFILE_SCOPE("write ppm");
+    simplePPM_write_ppm(path, size[0], size[1], &(imgscaled[0][0]));
 }
 
-template<int reflections_left, int reflection_bounces = 1, int shadow_bounces = 100>
-rgb intersect_scene(const scene& scene, const ray& r, std::mt19937_64& mt, const float reflection_spread = 100, const float shadow_spread = 20) {
-    if (reflections_left < 0) return r.dir.abs();
-    object const* closest_object;
-    intersection closest_intersection;
-
-    std::tie(closest_object, closest_intersection) = get_closest_intersection(scene, r);
-
-    if (closest_object) {
-        auto color = rgb{ 0,0,0 };
-        auto mat = closest_object->mat;
-        auto norm = closest_intersection.n;
-
-        auto pos_of_intersect = r.e + closest_intersection.d * r.dir;
-
-
-        for (const auto& light : scene.second) {
-            auto v = r.dir * (-1.f);
-            auto dist_to_light = (light.pos - pos_of_intersect).len();
-            auto l = (light.pos - pos_of_intersect).normalized();
-            auto h = (v + l).normalized();
-            auto n = mat.n;
-
-            for (auto i = 0; i < shadow_bounces; i++) {
-                auto wiggle = (shadow_bounces > 1) ? random_point_on_sphere(mt) : fvec3{ 0,0,0 };
+// set by ctrl-c during a progressive render, which then stops at the best image so far
+std::atomic<bool> cancel_render{ false };
 
+void request_cancel(int) {
+    cancel_render = true;
+}
 
-                auto ray_to_light = ray{ pos_of_intersect + (norm * .001f), (l * shadow_spread + wiggle).normalized() };
-                intersection intersection_towards_light;
-                std::tie(std::ignore, intersection_towards_light) = get_closest_intersection(scene, ray_to_light);
+int main(int argc, char* argv[])
+{
+    auto brute_force = false;
+    auto kernels = &best_kernels();
+    auto packets = true;
+    auto wavefront = false;
+    auto settings = render_settings{};
+    auto threads = 0;
+    auto tile_size = 32;
+    auto extra_lights = 0;
+    auto denoised = false;
+    auto denoiser = denoise_settings{};
+    auto progressive_mode = false;
+    auto progressive = progressive_settings{};
+    auto profiled = false;
+    const char* trace_file = nullptr;
+    auto heatmaps = false;
+    auto converge = false;
+    auto obj_paths = vector<const char*>();
+    auto fit_meshes = false;
+    const char* scene_path = nullptr;
+    auto instance_count = 0;
+    auto half_edges = false;
+    auto check_allocations = false;
+    auto convergence = convergence_settings{};
+    for (auto i = 1; i < argc; i++) {
+        auto has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--brute-force")) brute_force = true; // skip the bvh, for comparing results
+        if (!strcmp(argv[i], "--scalar-kernels")) kernels = &scalar_kernels();
+        if (!strcmp(argv[i], "--no-packets")) packets = false; // primary rays one at a time
+        if (!strcmp(argv[i], "--wavefront")) wavefront = true; // breadth first, see wavefront.h
+        if (!strcmp(argv[i], "--depth") && has_value) settings.max_depth = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--shadow-samples") && has_value) settings.shadow_samples = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--shadow-min-samples") && has_value) settings.shadow_min_samples = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--shadow-variance") && has_value) settings.shadow_variance = std::max(0.f, static_cast<float>(atof(argv[++i])));
+        if (!strcmp(argv[i], "--roulette-weight") && has_value) settings.roulette_weight = std::max(0.f, static_cast<float>(atof(argv[++i])));
+        if (!strcmp(argv[i], "--throughput-cutoff") && has_value) settings.throughput_cutoff = std::max(0.f, static_cast<float>(atof(argv[++i])));
+        if (!strcmp(argv[i], "--exact-lights") && has_value) settings.max_exact_lights = std::max(0, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--extra-lights") && has_value) extra_lights = std::max(0, atoi(argv[++i])); // for timing the light tree
+        if (!strcmp(argv[i], "--reflection-samples") && has_value) settings.reflection_samples = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--denoise")) denoised = true; // edge aware filter before tone mapping, see denoise.h
+        if (!strcmp(argv[i], "--denoise-iterations") && has_value) denoiser.iterations = std::max(0, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--progressive")) progressive_mode = true; // refine pass by pass, see progressive.h
+        if (!strcmp(argv[i], "--time-limit") && has_value) { progressive.time_limit = std::max(0., atof(argv[++i])); progressive_mode = true; }
+        if (!strcmp(argv[i], "--passes") && has_value) progressive.passes = std::max(0, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--snapshot-interval") && has_value) progressive.snapshot_interval = std::max(0., atof(argv[++i]));
+        if (!strcmp(argv[i], "--no-preview")) progressive.preview = false;
+        if (!strcmp(argv[i], "--profile")) profiled = true; // counters and timings at the end, see profiler.h
+        if (!strcmp(argv[i], "--trace") && has_value) { trace_file = argv[++i]; profiled = true; } // chrome://tracing json
+        if (!strcmp(argv[i], "--heatmap")) heatmaps = true; // per pixel cost next to out.ppm, see heatmap.h
+        if (!strcmp(argv[i], "--converge")) converge = true; // error against a reference over time, see convergence.h
+        if (!strcmp(argv[i], "--reference") && has_value) convergence.reference = argv[++i];
+        if (!strcmp(argv[i], "--reference-samples") && has_value) convergence.reference_samples = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--obj") && has_value) obj_paths.push_back(argv[++i]); // white mesh added to the room, see mesh.h
+        if (!strcmp(argv[i], "--fit")) fit_meshes = true; // scale the meshes into the room
+        if (!strcmp(argv[i], "--instances") && has_value) instance_count = std::max(0, atoi(argv[++i])); // copies of the meshes, or of a sphere cluster, see scene.h
+        if (!strcmp(argv[i], "--half-edges")) half_edges = true; // triangle edges as halves, see scene::store_half_edges
+        if (!strcmp(argv[i], "--check-allocations")) check_allocations = true; // fail unless tracing rays stays off the heap, see allocations.h
+        if (!strcmp(argv[i], "--scene") && has_value) scene_path = argv[++i]; // instead of the room, see scene_file.h
+        if (!strcmp(argv[i], "--threads") && has_value) threads = std::max(0, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--tile-size") && has_value) tile_size = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--pixel-samples") && has_value) settings.pixel_samples = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--max-pixel-samples") && has_value) settings.max_pixel_samples = std::max(1, atoi(argv[++i]));
+        if (!strcmp(argv[i], "--pixel-error") && has_value) settings.pixel_error = std::max(0.f, static_cast<float>(atof(argv[++i])));
+        if (!strcmp(argv[i], "--sample-budget") && has_value) settings.sample_budget = std::max(0.f, static_cast<float>(atof(argv[++i])));
+        if (!strcmp(argv[i], "--sampler") && has_value && !parse_sample_pattern(argv[++i], settings.pattern))
+            cout << "unknown sampler " << argv[i] << ", using " << sample_pattern_name(settings.pattern) << endl;
+    }
+    // these build the room, a scene file is taken as it is
+    if (scene_path && (!obj_paths.empty() || fit_meshes || extra_lights > 0 || instance_count > 0)) {
+        cout << "--obj, --fit, --extra-lights and --instances do not apply to --scene" << endl;
+        return 1;
+    }
 
-                auto visible = !(intersection_towards_light.valid && (intersection_towards_light.d < dist_to_light));
-                if (visible) {
-                    auto diffuse = mat.diff * light.color * std::max(0.f, dot(norm, l));
-                    auto specular = mat.spec * light.color * std::pow(std::max(0.f, dot(norm, h)), n);
-                    color += (diffuse.abs() + specular.abs()) / shadow_bounces;
-                }
-            }
 
-            auto ambient = light.color * mat.ambient;
-            color += ambient.abs();
+    if (profiled || heatmaps) profiler::start();
+    PROFILE_SPAN(load_span, "load scene");
+    auto view = scene_view{};
+    auto loaded = unique_ptr<scene>();
+    if (scene_path) {
+        loaded = open_scene(scene_path, brute_force, half_edges, *kernels, view);
+        if (!loaded) return 1;
+    }
+    else {
+        auto desc = load_scene();
+        // dim lights scattered through the room, as bright as one more light together
+        auto light_rng = randutils::pcg32{ 1 };
+        for (auto i = 0; i < extra_lights; i++) {
+            auto p = pos{ light_rng.uniform(), light_rng.uniform(), light_rng.uniform() } * 9.f - 4.5f;
+            desc.second.push_back(light{ p, rgb{ 1,1,1 } / static_cast<float>(extra_lights) });
         }
-
-        // reflectance
-        if (mat.r > 0) {
-            for (auto i = 0; i < reflection_bounces; i++) {
-                auto wiggle = (reflection_bounces > 1) ? random_point_on_sphere(mt) : fvec3{ 0,0,0 };
-
-                auto reflect_dir = ((r.dir - 2 * dot(r.dir, norm)*norm).normalized() * reflection_spread + wiggle).normalized();
-                auto reflect_ray = ray{ pos_of_intersect + (norm * .001f), reflect_dir };
-                const auto new_shadow_bounces = std::max(shadow_bounces / 2, 1);
-                auto reflect_color = intersect_scene<reflections_left - 1, 1, (reflections_left > 1 ? new_shadow_bounces : 1)>(scene, reflect_ray, mt);
-                color += (reflect_color * mat.r) / reflection_bounces;
+        auto meshes = vector<object_ptr>();
+        for (auto path : obj_paths) {
+            auto m = make_shared<mesh>(materials::white);
+            auto stats = obj_stats{};
+            if (!load_obj(path, *m, stats)) continue;
+            print_obj_stats(cout, stats, *m);
+            if (fit_meshes || instance_count > 0) m->fit(instance_count > 0 ? aabb{ pos{ -1,-1,-1 }, pos{ 1,1,1 } } : aabb{ pos{ -4,-4,-4 }, pos{ 4,4,4 } });
+            meshes.push_back(m);
+        }
+        if (instance_count > 0) {
+            // one geometry, the meshes or a small cluster of spheres, scattered
+            // through the room turned, scaled and recoloured
+            if (meshes.empty()) {
+                meshes = { make_sphere({ 0,0,0 }, .5f, materials::white), make_sphere({ .6f,0,0 }, .3f), make_sphere({ -.6f,0,0 }, .3f),
+                    make_sphere({ 0,.6f,0 }, .3f), make_sphere({ 0,-.6f,0 }, .3f), make_sphere({ 0,0,.6f }, .3f), make_sphere({ 0,0,-.6f }, .3f) };
+            }
+            auto built = make_shared<scene>(meshes, vector<light>{}, brute_force, *kernels);
+            if (!built->materials_fit()) {
+                cout << "more than 65536 distinct materials" << endl;
+                return 1;
             }
+            if (half_edges) built->store_half_edges();
+            auto geometry = shared_ptr<const scene>(built);
+            const material* colours[] = { nullptr, &materials::red, &materials::green, &materials::blue };
+            auto rng = randutils::pcg32{ 2 };
+            const auto size = 2.5f / std::cbrt(static_cast<float>(instance_count));
+            for (auto i = 0; i < instance_count; i++) {
+                const auto at = pos{ rng.uniform(), rng.uniform(), rng.uniform() } * 9.f - 4.5f;
+                const auto axis = fvec3{ rng.uniform(), rng.uniform(), rng.uniform() } - .5f;
+                const auto to_world = affine::translation(at) * affine::rotation(axis, rng.uniform() * 6.2832f) * affine::scaling(size * (.5f + rng.uniform() * .5f));
+                const auto mat = colours[static_cast<int>(rng.uniform() * 4) % 4];
+                desc.first.push_back(mat ? make_instance(geometry, to_world, *mat) : make_instance(geometry, to_world));
+            }
+            cout << "instances: " << instance_count << " of " << geometry->primitive_count() << " primitives, "
+                << instance_count * geometry->primitive_count() << " placed, " << geometry->primitive_count() << " stored" << endl;
         }
-
-        return color;
+        else {
+            desc.first.insert(desc.first.end(), meshes.begin(), meshes.end());
+        }
+        loaded = make_unique<scene>(desc.first, std::move(desc.second), brute_force, *kernels);
+        if (!loaded->materials_fit()) {
+            cout << "more than 65536 distinct materials" << endl;
+            return 1;
+        }
+        if (half_edges) loaded->store_half_edges();
     }
+    auto& s = *loaded;
+    PROFILE_STOP(load_span);
 
-    return r.dir.abs();
-}
-
-template<>
-rgb intersect_scene<0,1,1>(const scene&, const ray&, std::mt19937_64&, const float, const float) {
-    return{ 0,0,0 };
-}
-
-int main()
-{
-    const auto size = ivec2{ 1000, 1000 };
+    const auto size = view.resolution;
     auto c = camera{ size };
     auto img = vector<rgb>(size[0] * size[1]);
-    c.reposition({ -4.999f,0.001f,.001 }, { 0.001f,-0.01,-0.001f }, { 0,1,0 }); // jiggled
-
-    auto s = load_scene();
-
-#pragma omp parallel for schedule(dynamic)
-    for (auto y = 0; y < size[1]; ++y) {
-        std::mt19937_64 mt((uint64_t(randutils::devurand()) << 32) | randutils::devurand());
-        
-        if (y % 100 == 0)
-            cout << y*100.f / size[1] << endl;
-        
-        for (auto x = 0; x < size[0]; ++x) {
-            const auto idx = y*size[0] + x;
-            const auto r = c.castRay(x, y);
-            img[idx] = intersect_scene<10>(s, r, mt);
+    c.reposition(view.eye, view.target, view.up); // the built-in view is jiggled
+    print_layout(cout, s);
+    cout << "intersection kernels: " << s.kernels.name << endl;
+    cout << "sampler: " << sample_pattern_name(settings.pattern) << endl;
+    const auto seed = randutils::random_seed();
+    auto counts = ray_counts{};
+    auto aux = denoised ? aux_buffers{ img.size() } : aux_buffers{};
+    auto costs = heatmaps ? cost_map{ img.size() } : cost_map{};
+    auto imgscaled = vector<bvec<3>>();
+
+    if (check_allocations) {
+        if (!allocations::tracked) {
+            cout << "allocation counting is not compiled in, build with SOL_ALLOC_COUNT (Debug does)" << endl;
+            return 1;
         }
+        const auto n = hot_path_allocations(s, c, size, settings, seed);
+        cout << "heap allocations while tracing: " << n << (n == 0 ? " -> ok" : " -> FAILED") << endl;
+        return n == 0 ? 0 : 1;
     }
 
-    auto max = img[0].len();
-    for (auto& col : img) {
-        max = std::max(max, col.len());
+    if (converge) {
+        tile_scheduler scheduler(size, tile_size, threads);
+        return run_convergence(s, c, size, settings, progressive, seed, scheduler, convergence) ? 0 : 1;
     }
 
-    auto imgscaled = vector<bvec<3>>(size[0] * size[1]);
-    for (int i = 0; i < size[0] * size[1]; ++i) {
-        auto red = static_cast<uint8_t>(img[i][0] / max * 0xFF);
-        auto gre = static_cast<uint8_t>(img[i][1] / max * 0xFF);
-        auto blu = static_cast<uint8_t>(img[i][2] / max * 0xFF);
-        auto alp = static_cast<uint8_t>(0xFF);
-        imgscaled[i] = { red, gre, blu };
+    PROFILE_SPAN(render_span, "render");
+    if (wavefront) {
+        if (settings.supersampling())
+            cout << "the wavefront integrator traces one ray per pixel, ignoring the pixel samples" << endl;
+        if (costs.enabled())
+            cout << "the wavefront integrator traces breadth first, it has no per pixel costs" << endl;
+        render_wavefront(s, c, size, settings, seed, img, counts, aux);
     }
+    else {
+        // whole packets per tile, so no packet straddles two tiles
+        tile_size = (tile_size + ray_packet::dim - 1) / ray_packet::dim * ray_packet::dim;
+        tile_scheduler scheduler(size, tile_size, threads);
+        cout << "threads: " << scheduler.thread_count << ", tiles: " << scheduler.tiles.size() << endl;
+
+        if (progressive_mode) {
+            std::signal(SIGINT, request_cancel);
+            auto snapshot = [&](const vector<rgb>& partial) { write_image("out.ppm", partial, size, imgscaled); };
+            render_progressive(s, c, size, settings, seed, scheduler, progressive, cancel_render, snapshot, img, counts, aux, costs);
+            std::signal(SIGINT, SIG_DFL);
+        }
+        else if (settings.supersampling()) {
+            // jittered rays do not share a packet frustum, one at a time
+            render_supersampled(s, c, size, settings, seed, scheduler, img, counts, aux, costs);
+        }
+        else {
+            // per worker, lives on the worker's stack
+            struct worker_state {
+                sampler smp;
+                ray_counts counts;
+                ray_packet p;
+                std::pair<material const*, intersection> hits[ray_packet::size];
+            };
+            auto make_state = [&]() { return worker_state{ sampler{ settings.pattern, seed } }; };
+            std::mutex counts_lock;
+
+            scheduler.run(make_state, [&](const tile& t, worker_state& w) {
+                if (!packets) {
+                    for (auto y = t.y0; y < t.y0 + t.height; ++y) {
+                        for (auto x = t.x0; x < t.x0 + t.width; ++x) {
+                            const auto from = costs.now();
+                            const auto r = c.castRay(x, y);
+                            const auto hit = s.closest_hit(r);
+                            aux.record(y*size[0] + x, r, hit);
+                            w.smp.start_pixel(x, y);
+                            img[y*size[0] + x] = trace_path(s, r, hit, settings, w.smp, w.counts);
+                            costs.add(y*size[0] + x, from, costs.now());
+                        }
+                    }
+                    return;
+                }
 
-    simplePPM_write_ppm("out.ppm", size[0], size[1], &(imgscaled[0][0]));
+                for (auto y0 = t.y0; y0 < t.y0 + t.height; y0 += ray_packet::dim) {
+                    for (auto x0 = t.x0; x0 < t.x0 + t.width; x0 += ray_packet::dim) {
+                        const auto packet_start = costs.now();
+                        c.castPacket(x0, y0, w.p);
+                        s.closest_hit(w.p, w.hits);
+                        const auto packet_end = costs.now();
+                        const auto share = 1.f / (w.p.width * w.p.height);
+                        for (auto y = 0; y < w.p.height; ++y) {
+                            for (auto x = 0; x < w.p.width; ++x) {
+                                const auto idx = (y0 + y)*size[0] + x0 + x;
+                                const auto& hit = w.hits[y * ray_packet::dim + x];
+                                const auto from = costs.now();
+                                const auto r = c.castRay(x0 + x, y0 + y);
+                                aux.record(idx, r, hit);
+                                w.smp.start_pixel(x0 + x, y0 + y);
+                                img[idx] = trace_path(s, r, hit, settings, w.smp, w.counts);
+                                costs.add(idx, from, costs.now());
+                                costs.add(idx, packet_start, packet_end, share);
+                            }
+                        }
+                    }
+                }
+            }, [&](worker_state& w) {
+                std::lock_guard<std::mutex> guard(counts_lock);
+                counts += w.counts;
+            });
+        }
+    }
+    PROFILE_STOP(render_span);
+    print_ray_counts(cout, counts);
+    {
+        PROFILE_SCOPE("denoise");
+        denoise(img, aux, size, denoiser);
+    }
+
+    write_image("out.ppm", img, size, imgscaled);
+    costs.write("out", size);
+
+    if (profiled) {
+        profiler::print_summary(cout, size[0] * size[1]);
+        if (trace_file && !profiler::write_trace(trace_file))
+            cout << "could not write " << trace_file << endl;
+    }
 }
\ No newline at end of file
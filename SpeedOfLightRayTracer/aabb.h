@@ -0,0 +1,60 @@
+#pragma once
+#include "genvec.h"
+#include <algorithm>
+#include <limits>
+
+using genvec::pos;
+
+// axis aligned bounding box, default constructed boxes are empty
+class aabb
+{
+public:
+    aabb()
+        : lo(big(), big(), big())
+        , hi(-big(), -big(), -big()) {}
+
+    aabb(const pos& lo, const pos& hi)
+        : lo(lo)
+        , hi(hi) {}
+
+    void grow(const pos& p) {
+        for (auto i = 0; i < 3; i++) {
+            lo[i] = std::min(lo[i], p[i]);
+            hi[i] = std::max(hi[i], p[i]);
+        }
+    }
+
+    void grow(const aabb& b) {
+        grow(b.lo);
+        grow(b.hi);
+    }
+
+    bool empty() const {
+        return lo[0] > hi[0];
+    }
+
+    pos centroid() const {
+        return (lo + hi) * .5f;
+    }
+
+    pos extent() const {
+        return hi - lo;
+    }
+
+    float surface_area() const {
+        if (empty()) return 0;
+        auto e = extent();
+        return 2 * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+    }
+
+    int longest_axis() const {
+        auto e = extent();
+        return (e[0] > e[1]) ? (e[0] > e[2] ? 0 : 2) : (e[1] > e[2] ? 1 : 2);
+    }
+
+    pos lo;
+    pos hi;
+
+private:
+    static float big() { return std::numeric_limits<float>::max(); }
+};
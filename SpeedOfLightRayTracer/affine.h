@@ -0,0 +1,99 @@
+#pragma once
+#include "genvec.h"
+#include "aabb.h"
+#include <cmath>
+
+using genvec::pos;
+using genvec::fvec3;
+
+// Affine transform as the top three rows of a 4x4 matrix: p' = m p + t,
+// the translation in the last column. Default constructed is the identity.
+struct affine
+{
+    float m[3][4] = { { 1,0,0,0 }, { 0,1,0,0 }, { 0,0,1,0 } };
+
+    static affine translation(const fvec3& t) {
+        auto a = affine{};
+        for (auto i = 0; i < 3; i++) a.m[i][3] = t[i];
+        return a;
+    }
+
+    static affine scaling(float s) {
+        auto a = affine{};
+        for (auto i = 0; i < 3; i++) a.m[i][i] = s;
+        return a;
+    }
+
+    // right handed rotation by radians about an axis through the origin
+    static affine rotation(const fvec3& axis, float radians) {
+        const auto u = axis.normalized();
+        const auto c = std::cos(radians), s = std::sin(radians), k = 1 - c;
+        auto a = affine{};
+        a.m[0][0] = c + u[0] * u[0] * k;        a.m[0][1] = u[0] * u[1] * k - u[2] * s; a.m[0][2] = u[0] * u[2] * k + u[1] * s;
+        a.m[1][0] = u[1] * u[0] * k + u[2] * s; a.m[1][1] = c + u[1] * u[1] * k;        a.m[1][2] = u[1] * u[2] * k - u[0] * s;
+        a.m[2][0] = u[2] * u[0] * k - u[1] * s; a.m[2][1] = u[2] * u[1] * k + u[0] * s; a.m[2][2] = c + u[2] * u[2] * k;
+        return a;
+    }
+
+    // this after b
+    affine operator*(const affine& b) const {
+        auto a = affine{};
+        for (auto i = 0; i < 3; i++) {
+            for (auto j = 0; j < 4; j++) {
+                a.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j] + (j == 3 ? m[i][3] : 0.f);
+            }
+        }
+        return a;
+    }
+
+    pos point(const pos& p) const {
+        return vector(p) + fvec3{ m[0][3], m[1][3], m[2][3] };
+    }
+
+    fvec3 vector(const fvec3& v) const {
+        return fvec3{
+            m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+            m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+            m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2] };
+    }
+
+    // the linear part transposed; with the inverse transform this carries
+    // normals across, since they go by the inverse transpose
+    fvec3 transposed_vector(const fvec3& v) const {
+        return fvec3{
+            m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+            m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+            m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2] };
+    }
+
+    // the transform undoing this one, which has to be invertible
+    affine inverse() const {
+        auto a = affine{};
+        const auto det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+            - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+            + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        const auto inv = 1 / det;
+        a.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv;
+        a.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv;
+        a.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv;
+        a.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv;
+        a.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv;
+        a.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv;
+        a.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv;
+        a.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv;
+        a.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv;
+        const auto t = a.vector(fvec3{ m[0][3], m[1][3], m[2][3] });
+        for (auto i = 0; i < 3; i++) a.m[i][3] = -t[i];
+        return a;
+    }
+
+    // box around the transformed corners of b
+    aabb bounds(const aabb& b) const {
+        auto box = aabb{};
+        if (b.empty()) return box;
+        for (auto corner = 0; corner < 8; corner++) {
+            box.grow(point(pos{ corner & 1 ? b.hi[0] : b.lo[0], corner & 2 ? b.hi[1] : b.lo[1], corner & 4 ? b.hi[2] : b.lo[2] }));
+        }
+        return box;
+    }
+};
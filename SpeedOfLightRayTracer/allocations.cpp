@@ -0,0 +1,99 @@
+#include "stdafx.h"
+#include "allocations.h"
+#include "scene.h"
+#include "integrator.h"
+#include "sampler.h"
+#include "render_settings.h"
+#include <new>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef SOL_ALLOC_COUNT
+namespace {
+    // constant initialized, so reading it from operator new needs no guard
+    thread_local uint64_t thread_allocations = 0;
+
+    void* counted_alloc(size_t n) {
+        thread_allocations++;
+        if (n == 0) n = 1;
+        while (true) {
+            if (auto p = std::malloc(n)) return p;
+            auto handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* counted_alloc(size_t n, const std::nothrow_t&) noexcept {
+        try {
+            return counted_alloc(n);
+        }
+        catch (...) {
+            return nullptr;
+        }
+    }
+}
+
+// the aligned forms are left to the library, they pair with its own deletes
+void* operator new(size_t n) { return counted_alloc(n); }
+void* operator new[](size_t n) { return counted_alloc(n); }
+void* operator new(size_t n, const std::nothrow_t& tag) noexcept { return counted_alloc(n, tag); }
+void* operator new[](size_t n, const std::nothrow_t& tag) noexcept { return counted_alloc(n, tag); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+const bool allocations::tracked = true;
+
+uint64_t allocations::count()
+{
+    return thread_allocations;
+}
+#else
+const bool allocations::tracked = false;
+
+uint64_t allocations::count()
+{
+    return 0;
+}
+#endif
+
+uint64_t hot_path_allocations(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed)
+{
+    auto smp = sampler{ settings.pattern, seed };
+    auto counts = ray_counts{};
+    ray_packet p;
+    std::pair<material const*, intersection> hits[ray_packet::size];
+
+    // about 16 x 16 packets spread over the image
+    const auto step = std::max(1, std::max(size[0], size[1]) / (16 * ray_packet::dim)) * ray_packet::dim;
+    auto pass = [&]() {
+        for (auto y0 = 0; y0 < size[1]; y0 += step) {
+            for (auto x0 = 0; x0 < size[0]; x0 += step) {
+                c.castPacket(x0, y0, p);
+                s.closest_hit(p, hits);
+                for (auto y = 0; y < p.height; y++) {
+                    for (auto x = 0; x < p.width; x++) {
+                        const auto r = c.castRay(x0 + x, y0 + y);
+                        const auto hit = s.closest_hit(r);
+                        if (hit.first && !s.lights.empty()) {
+                            const auto at = r.e + hit.second.d * r.dir + hit.second.n * .001f;
+                            const auto to_light = s.lights[0].pos - at;
+                            s.occluded(ray{ at, to_light.normalized() }, to_light.len());
+                        }
+                        smp.start_pixel(x0 + x, y0 + y);
+                        trace_path(s, r, settings, smp, counts);
+                    }
+                }
+            }
+        }
+    };
+
+    pass();
+    const auto before = allocations::count();
+    pass();
+    return allocations::count() - before;
+}
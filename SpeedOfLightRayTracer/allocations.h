@@ -0,0 +1,25 @@
+#pragma once
+#include "genvec.h"
+#include <cstdint>
+
+class scene;
+class camera;
+struct render_settings;
+
+// Heap allocations counted per thread by replacing the global operator new,
+// so a test can check that tracing rays never goes to the allocator, where
+// threads would queue up behind each other. Reading the count is one
+// thread local load. Only builds that define SOL_ALLOC_COUNT, Debug and
+// the bench, replace operator new; elsewhere count() stays at 0.
+namespace allocations {
+    // false without SOL_ALLOC_COUNT
+    extern const bool tracked;
+
+    // operator new calls on this thread so far
+    uint64_t count();
+}
+
+// Allocations this thread makes tracing a grid of pixels over the image:
+// packets, closest hit and shadow queries one ray at a time and whole
+// paths. One uncounted pass first, so lazily built tables do not count.
+uint64_t hot_path_allocations(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed);
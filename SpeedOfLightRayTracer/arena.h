@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+
+// Bump allocator for temporaries of plain data. Pieces are cut from big
+// blocks and given back all at once when a scope ends; the blocks stay, so
+// once an arena has grown to what a job needs it never allocates again.
+// Not thread safe, use scratch_arena() for one per thread.
+class arena
+{
+public:
+    explicit arena(size_t block_size = 1 << 16) : block_size(block_size) {}
+
+    // n uninitialized elements, aligned for T
+    template<typename T>
+    T* alloc(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        const auto bytes = n * sizeof(T);
+        while (true) {
+            if (current < blocks.size()) {
+                const auto at = (used + alignof(T) - 1) / alignof(T) * alignof(T);
+                if (at + bytes <= blocks[current].size) {
+                    used = at + bytes;
+                    return reinterpret_cast<T*>(blocks[current].data.get() + at);
+                }
+                current++;
+                used = 0;
+                continue;
+            }
+            // a new block always fits the request, even one above block_size
+            const auto size = std::max(block_size, bytes);
+            blocks.push_back(block{ std::unique_ptr<unsigned char[]>(new unsigned char[size]), size });
+        }
+    }
+
+    // everything allocated while a scope lives goes back when it ends
+    class scope
+    {
+    public:
+        explicit scope(arena& a) : a(a), current(a.current), used(a.used) {}
+        ~scope() { a.current = current; a.used = used; }
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        arena& a;
+        size_t current, used;
+    };
+
+    size_t capacity() const {
+        auto total = size_t{ 0 };
+        for (const auto& b : blocks) total += b.size;
+        return total;
+    }
+
+private:
+    struct block {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+    std::vector<block> blocks;
+    size_t current = 0, used = 0;
+    size_t block_size;
+};
+
+// this thread's arena, for scratch that lives during one piece of work
+inline arena& scratch_arena() {
+    thread_local arena a;
+    return a;
+}
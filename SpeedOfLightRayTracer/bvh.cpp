@@ -0,0 +1,164 @@
+#include "stdafx.h"
+#include "bvh.h"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+    const int sah_bins = 16;
+    const float traversal_cost = 1.f;
+    const float intersection_cost = 1.f;
+
+    struct bin {
+        aabb bounds;
+        uint32_t count = 0;
+    };
+}
+
+bvh::bvh(const std::vector<aabb>& prim_bounds, int leaf_width)
+    : leaf_width(leaf_width)
+    , max_leaf_size(static_cast<uint32_t>(std::max(4, leaf_width)))
+{
+    if (prim_bounds.empty()) return;
+
+    auto centroids = std::vector<pos>();
+    centroids.reserve(prim_bounds.size());
+    for (const auto& b : prim_bounds) {
+        centroids.push_back(b.centroid());
+    }
+
+    order.resize(prim_bounds.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    nodes.reserve(2 * prim_bounds.size());
+    build(prim_bounds, centroids, 0, static_cast<uint32_t>(prim_bounds.size()), 0);
+}
+
+uint32_t bvh::build(const std::vector<aabb>& prim_bounds, const std::vector<pos>& centroids, uint32_t begin, uint32_t end, int depth)
+{
+    const auto node_index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    auto box = aabb{};
+    auto centroid_box = aabb{};
+    for (auto i = begin; i < end; i++) {
+        box.grow(prim_bounds[order[i]]);
+        centroid_box.grow(centroids[order[i]]);
+    }
+
+    for (auto i = 0; i < 3; i++) {
+        nodes[node_index].lo[i] = box.lo[i];
+        nodes[node_index].hi[i] = box.hi[i];
+    }
+
+    const auto count = end - begin;
+    auto make_leaf = [&]() {
+        nodes[node_index].offset = begin;
+        nodes[node_index].count = static_cast<uint16_t>(count);
+        return node_index;
+    };
+
+    if (count == 1 || depth >= max_depth - 1) return make_leaf();
+
+    // binned SAH over all three axes
+    auto best_axis = -1;
+    auto best_split = 0;
+    // a leaf costs one kernel step per leaf_width primitives
+    auto steps = [&](uint32_t n) { return static_cast<float>((n + leaf_width - 1) / leaf_width); };
+    auto best_cost = intersection_cost * steps(count);
+    const auto parent_area = std::max(box.surface_area(), 1e-20f);
+
+    for (auto axis = 0; axis < 3; axis++) {
+        const auto lo = centroid_box.lo[axis];
+        const auto extent = centroid_box.hi[axis] - lo;
+        if (extent <= 0) continue;
+        const auto scale = sah_bins / extent;
+
+        bin bins[sah_bins];
+        for (auto i = begin; i < end; i++) {
+            auto b = std::min(sah_bins - 1, static_cast<int>((centroids[order[i]][axis] - lo) * scale));
+            bins[b].count++;
+            bins[b].bounds.grow(prim_bounds[order[i]]);
+        }
+
+        // sweep from the right to get the area of every right hand side
+        float right_area[sah_bins];
+        uint32_t right_count[sah_bins];
+        auto acc = aabb{};
+        auto acc_count = 0u;
+        for (auto b = sah_bins - 1; b > 0; b--) {
+            acc.grow(bins[b].bounds);
+            acc_count += bins[b].count;
+            right_area[b] = acc.surface_area();
+            right_count[b] = acc_count;
+        }
+
+        acc = aabb{};
+        acc_count = 0;
+        for (auto b = 1; b < sah_bins; b++) {
+            acc.grow(bins[b - 1].bounds);
+            acc_count += bins[b - 1].count;
+            if (acc_count == 0 || right_count[b] == 0) continue;
+
+            auto cost = traversal_cost + intersection_cost * (acc.surface_area() * steps(acc_count) + right_area[b] * steps(right_count[b])) / parent_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    auto mid = begin;
+    if (best_axis >= 0) {
+        const auto lo = centroid_box.lo[best_axis];
+        const auto scale = sah_bins / (centroid_box.hi[best_axis] - lo);
+        auto it = std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t p) {
+            return std::min(sah_bins - 1, static_cast<int>((centroids[p][best_axis] - lo) * scale)) < best_split;
+        });
+        mid = static_cast<uint32_t>(it - order.begin());
+    }
+    else if (count <= max_leaf_size) {
+        return make_leaf();
+    }
+    else {
+        // SAH sees no gain (or all centroids coincide) but the leaf is too
+        // big, split at the median of the longest axis
+        best_axis = centroid_box.longest_axis();
+        mid = begin + count / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](uint32_t a, uint32_t b) {
+            return centroids[a][best_axis] < centroids[b][best_axis];
+        });
+    }
+
+    nodes[node_index].axis = static_cast<uint16_t>(best_axis);
+    nodes[node_index].count = 0;
+    build(prim_bounds, centroids, begin, mid, depth + 1);
+    nodes[node_index].offset = build(prim_bounds, centroids, mid, end, depth + 1);
+    return node_index;
+}
+
+aabb bvh::bounds() const
+{
+    if (nodes.empty()) return{};
+    const auto& n = nodes[0];
+    return{ pos{ n.lo[0], n.lo[1], n.lo[2] }, pos{ n.hi[0], n.hi[1], n.hi[2] } };
+}
+
+size_t bvh::depth() const
+{
+    if (nodes.empty()) return 0;
+
+    auto deepest = size_t{ 0 };
+    auto stack = std::vector<std::pair<uint32_t, size_t>>{ { 0, 1 } };
+    while (!stack.empty()) {
+        auto top = stack.back();
+        stack.pop_back();
+        deepest = std::max(deepest, top.second);
+        const auto& n = nodes[top.first];
+        if (!n.leaf()) {
+            stack.push_back({ top.first + 1, top.second + 1 });
+            stack.push_back({ n.offset, top.second + 1 });
+        }
+    }
+    return deepest;
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "aabb.h"
+#include "flat_array.h"
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+// 32 bytes, two nodes per cache line. Nodes are stored depth first, so the
+// first child of an interior node always directly follows its parent.
+struct bvh_node
+{
+    float lo[3];
+    uint32_t offset; // leaf: first primitive, interior: index of the second child
+    float hi[3];
+    uint16_t count;  // number of primitives, 0 for interior nodes
+    uint16_t axis;   // split axis of interior nodes
+
+    bool leaf() const { return count != 0; }
+};
+static_assert(sizeof(bvh_node) == 32, "bvh_node should stay 32 bytes");
+
+// ray in the form the slab test wants it
+struct bvh_ray
+{
+    explicit bvh_ray(const ray& r) {
+        for (auto i = 0; i < 3; i++) {
+            o[i] = r.e[i];
+            inv[i] = 1.f / r.dir[i];
+            neg[i] = inv[i] < 0;
+        }
+    }
+
+    // returns the entry distance, or a negative number when the box is missed
+    inline float hit(const bvh_node& n, float tmax) const {
+        auto t0 = 0.f;
+        auto t1 = tmax;
+        for (auto i = 0; i < 3; i++) {
+            auto a = (n.lo[i] - o[i]) * inv[i];
+            auto b = (n.hi[i] - o[i]) * inv[i];
+            if (neg[i]) std::swap(a, b);
+            // written so a NaN (origin on a slab, parallel ray) does not cull
+            t0 = a > t0 ? a : t0;
+            t1 = b < t1 ? b : t1;
+        }
+        return (t0 <= t1) ? t0 : -1.f;
+    }
+
+    float o[3];
+    float inv[3];
+    int neg[3];
+};
+
+// Bounding volume hierarchy built with the binned surface area heuristic.
+// The tree only knows primitive bounds: after construction order[i] is the
+// input primitive stored at position i, and callers are expected to permute
+// their primitive arrays by it so that every leaf covers a contiguous range.
+class bvh
+{
+public:
+    static const int max_depth = 64;
+
+    bvh() {}
+
+    // leaf_width is the number of primitives the intersection kernels test
+    // in one go; leaves are priced and sized in multiples of it
+    explicit bvh(const std::vector<aabb>& prim_bounds, int leaf_width = 1);
+
+    // a tree built before, over primitives already in its order
+    explicit bvh(flat_array<bvh_node> prebuilt) : nodes(std::move(prebuilt)) {}
+
+    // Walks the leaves a ray can reach closer than tmax, nearest side first.
+    // hit(first, count, tmax) tests the primitive range [first, first + count)
+    // and returns the new closest distance, or tmax when nothing closer was hit.
+    template<typename F>
+    float closest_hit(const ray& r, float tmax, F&& hit) const {
+        if (nodes.empty()) return tmax;
+
+        const bvh_ray br(r);
+        uint32_t stack[max_depth];
+        auto sp = 0;
+        uint32_t ni = 0;
+
+        while (true) {
+            const auto& n = nodes[ni];
+            if (br.hit(n, tmax) >= 0) {
+                if (n.leaf()) {
+                    tmax = hit(n.offset, static_cast<uint32_t>(n.count), tmax);
+                }
+                else {
+                    auto near_child = ni + 1;
+                    auto far_child = n.offset;
+                    if (br.neg[n.axis]) std::swap(near_child, far_child);
+                    stack[sp++] = far_child;
+                    ni = near_child;
+                    continue;
+                }
+            }
+            if (sp == 0) break;
+            ni = stack[--sp];
+        }
+
+        return tmax;
+    }
+
+    // Any-hit query for shadow rays: no ordering, stops at the first leaf for
+    // which occludes(first, count, tmax) reports a blocker closer than tmax.
+    template<typename F>
+    bool any_hit(const ray& r, float tmax, F&& occludes) const {
+        if (nodes.empty()) return false;
+
+        const bvh_ray br(r);
+        uint32_t stack[max_depth];
+        auto sp = 0;
+        uint32_t ni = 0;
+
+        while (true) {
+            const auto& n = nodes[ni];
+            if (br.hit(n, tmax) >= 0) {
+                if (n.leaf()) {
+                    if (occludes(n.offset, static_cast<uint32_t>(n.count), tmax))
+                        return true;
+                }
+                else {
+                    stack[sp++] = n.offset;
+                    ni = ni + 1;
+                    continue;
+                }
+            }
+            if (sp == 0) break;
+            ni = stack[--sp];
+        }
+
+        return false;
+    }
+
+    // Closest-hit walk for a packet of primary rays. A node outside the
+    // packet frustum is dropped once for the whole packet, otherwise it is
+    // visited when any ray of the packet can still reach it.
+    // hit(first, count) updates the packet's t for the leaf range.
+    template<typename F>
+    void packet_closest_hit(const ray_packet& p, F&& hit) const {
+        if (nodes.empty()) return;
+
+        uint32_t stack[max_depth];
+        auto sp = 0;
+        uint32_t ni = 0;
+
+        while (true) {
+            const auto& n = nodes[ni];
+            if (!p.bounds.misses_box(n.lo, n.hi) && p.reaches(n.lo, n.hi)) {
+                if (n.leaf()) {
+                    hit(n.offset, static_cast<uint32_t>(n.count));
+                }
+                else {
+                    auto near_child = ni + 1;
+                    auto far_child = n.offset;
+                    if (p.neg[n.axis]) std::swap(near_child, far_child);
+                    stack[sp++] = far_child;
+                    ni = near_child;
+                    continue;
+                }
+            }
+            if (sp == 0) break;
+            ni = stack[--sp];
+        }
+    }
+
+    // Recomputes every box bottom up for primitives that moved a little,
+    // keeping the tree. box(first, count) bounds the primitive range.
+    template<typename F>
+    void refit(F&& box) {
+        auto* n = nodes.data();
+        for (auto i = nodes.size(); i-- > 0;) {
+            auto b = aabb{};
+            if (n[i].leaf()) {
+                b = box(n[i].offset, static_cast<uint32_t>(n[i].count));
+            }
+            else {
+                // children come after their parent, so they are done already
+                for (const auto& c : { n[i + 1], n[n[i].offset] }) {
+                    b.grow(aabb{ pos{ c.lo[0], c.lo[1], c.lo[2] }, pos{ c.hi[0], c.hi[1], c.hi[2] } });
+                }
+            }
+            for (auto k = 0; k < 3; k++) {
+                n[i].lo[k] = b.lo[k];
+                n[i].hi[k] = b.hi[k];
+            }
+        }
+    }
+
+    aabb bounds() const;
+    size_t depth() const;
+
+    flat_array<bvh_node> nodes;
+    std::vector<uint32_t> order;
+
+private:
+    int leaf_width = 1;
+    uint32_t max_leaf_size = 4;
+
+    uint32_t build(const std::vector<aabb>& prim_bounds, const std::vector<pos>& centroids, uint32_t begin, uint32_t end, int depth);
+};
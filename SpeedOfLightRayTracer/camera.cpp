@@ -27,9 +27,63 @@ void camera::reposition(const pos& center, const pos& lookat, const fvec3& up)
 
 ray camera::castRay(int i, int j)
 {
-	auto  U = l + (r - l) * (i + 0.5f) / wid;
-	auto  V = b + (t - b) * (j + 0.5f) / hei;
+	return castRay(i, j, 0.5f, 0.5f);
+}
+
+ray camera::castRay(int i, int j, float dx, float dy)
+{
+	auto  U = l + (r - l) * (i + dx) / wid;
+	auto  V = b + (t - b) * (j + dy) / hei;
 	auto dir = ((-d)*w) + (u*U) + (v*V);
 
 	return ray{ this->e, dir };
 }
+
+void camera::castPacket(int x0, int y0, ray_packet& p)
+{
+	p.x0 = x0;
+	p.y0 = y0;
+	p.width = std::min(ray_packet::dim, wid - x0);
+	p.height = std::min(ray_packet::dim, hei - y0);
+	p.ox = e[0];
+	p.oy = e[1];
+	p.oz = e[2];
+
+	for (auto y = 0; y < ray_packet::dim; y++) {
+		for (auto x = 0; x < ray_packet::dim; x++) {
+			const auto lane = y * ray_packet::dim + x;
+			const auto inside = x < p.width && y < p.height;
+			// padding lanes repeat the first ray so they stay finite
+			const auto r = inside ? castRay(x0 + x, y0 + y) : castRay(x0, y0);
+			p.dx[lane] = r.dir[0];
+			p.dy[lane] = r.dir[1];
+			p.dz[lane] = r.dir[2];
+			p.ix[lane] = 1.f / r.dir[0];
+			p.iy[lane] = 1.f / r.dir[1];
+			p.iz[lane] = 1.f / r.dir[2];
+			p.t[lane] = inside ? std::numeric_limits<float>::infinity() : 0.f;
+			p.sphere[lane] = std::numeric_limits<uint32_t>::max();
+			p.triangle[lane] = std::numeric_limits<uint32_t>::max();
+		}
+	}
+
+	// the frustum goes through the outer pixel edges, not the pixel centres,
+	// so every ray is strictly inside it
+	auto edge = [&](int i, int j) {
+		auto U = l + (r - l) * i / wid;
+		auto V = b + (t - b) * j / hei;
+		return ((-d)*w) + (u*U) + (v*V);
+	};
+	const fvec3 corners[4] = {
+		edge(x0, y0),
+		edge(x0 + p.width, y0),
+		edge(x0 + p.width, y0 + p.height),
+		edge(x0, y0 + p.height),
+	};
+	p.bounds = frustum{ e, corners };
+
+	auto center = corners[0] + corners[2];
+	for (auto i = 0; i < 3; i++) {
+		p.neg[i] = center[i] < 0;
+	}
+}
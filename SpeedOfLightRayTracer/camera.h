@@ -1,5 +1,6 @@
 #pragma once
 #include "genvec.h"
+#include "packet.h"
 #include <sstream>
 
 using genvec::pos;
@@ -26,6 +27,10 @@ public:
 	camera(int width, int height);
 	camera(const genvec::ivec2& dim);
 	ray castRay(int i, int j);
+	// through (i + dx, j + dy), dx and dy in [0, 1), for supersampling
+	ray castRay(int i, int j, float dx, float dy);
+	// the ray_packet::dim square tile starting at pixel (x0, y0)
+	void castPacket(int x0, int y0, ray_packet& p);
 	void reposition(const pos& center, const pos& lookat, const fvec3& up);
 	pos center() const { return e; };
 
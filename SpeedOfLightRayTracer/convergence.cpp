@@ -0,0 +1,318 @@
+#include "stdafx.h"
+#include "convergence.h"
+#include "supersample.h"
+#include "simplePPM.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <initializer_list>
+
+namespace {
+    using steady_clock = std::chrono::steady_clock;
+
+    // the image the errors are taken against, already divided by the scale
+    // the tone mapping would use, and that scale for the test images
+    struct reference_image {
+        std::vector<rgb> img;
+        float scale = 0; // 0: divide a test image by its own brightest pixel
+    };
+
+    float brightest(const std::vector<rgb>& img) {
+        auto max = 0.f;
+        for (const auto& col : img) {
+            max = std::max(max, col.len());
+        }
+        return max;
+    }
+
+    // divides by the brightest pixel and returns it
+    float normalize(std::vector<rgb>& img) {
+        const auto max = brightest(img);
+        if (max <= 0) return 1;
+        for (auto& col : img) {
+            col = col / max;
+        }
+        return max;
+    }
+
+    bool ends_with(const std::string& s, const char* suffix) {
+        const auto n = std::string(suffix).size();
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    }
+
+    bool load_reference(const std::string& path, const genvec::ivec2& size, reference_image& ref) {
+        if (!std::ifstream(path)) return false;
+
+        unsigned int w = 0, h = 0;
+        ref.img.resize(size[0] * size[1]);
+        if (ends_with(path, ".ppm")) {
+            auto bytes = simplePPM_read_ppm(path.c_str(), &w, &h);
+            if (static_cast<int>(w) == size[0] && static_cast<int>(h) == size[1]) {
+                for (size_t i = 0; i < ref.img.size(); i++) {
+                    ref.img[i] = rgb{ bytes[i * 3] / 255.f, bytes[i * 3 + 1] / 255.f, bytes[i * 3 + 2] / 255.f };
+                }
+            }
+            free(bytes);
+            ref.scale = 0;
+        }
+        else {
+            auto channels = 0u;
+            auto floats = simplePPM_read_pfm(path.c_str(), &w, &h, &channels);
+            if (static_cast<int>(w) == size[0] && static_cast<int>(h) == size[1] && channels == 3) {
+                for (size_t i = 0; i < ref.img.size(); i++) {
+                    ref.img[i] = rgb{ floats[i * 3], floats[i * 3 + 1], floats[i * 3 + 2] };
+                }
+            }
+            free(floats);
+            ref.scale = normalize(ref.img);
+        }
+
+        if (static_cast<int>(w) != size[0] || static_cast<int>(h) != size[1]) {
+            std::cout << path << " is " << w << "x" << h << ", not " << size[0] << "x" << size[1] << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    double rmse(const std::vector<rgb>& img, const reference_image& ref) {
+        const auto scale = ref.scale > 0 ? ref.scale : brightest(img);
+        auto sum = 0.;
+        for (size_t i = 0; i < img.size(); i++) {
+            const auto d = (scale > 0 ? img[i] / scale : img[i]) - ref.img[i];
+            sum += d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        }
+        return std::sqrt(sum / (img.size() * 3));
+    }
+
+    // peak signal to noise ratio for a peak of 1
+    double psnr(double rmse) {
+        return rmse > 0 ? -20 * std::log10(rmse) : INFINITY;
+    }
+
+    // FNV-1a
+    uint64_t hash_bytes(const void* data, size_t n, uint64_t h) {
+        auto p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < n; i++) {
+            h = (h ^ p[i]) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    template<typename T>
+    uint64_t hash_array(const flat_array<T>& a, uint64_t h) {
+        return hash_bytes(a.data(), a.size() * sizeof(T), h);
+    }
+
+    // one value at a time, rgb and pos may be padded
+    uint64_t hash_floats(std::initializer_list<float> values, uint64_t h) {
+        for (auto v : values) h = hash_bytes(&v, sizeof(v), h);
+        return h;
+    }
+
+    uint64_t hash_scene(const scene& s, uint64_t h) {
+        const auto& sp = s.spheres;
+        for (const auto* a : { &sp.cx, &sp.cy, &sp.cz, &sp.rsq }) h = hash_array(*a, h);
+        h = hash_array(sp.mat, h);
+        const auto& t = s.triangles;
+        for (const auto* a : { &t.ax, &t.ay, &t.az, &t.e1x, &t.e1y, &t.e1z, &t.e2x, &t.e2y, &t.e2z }) h = hash_array(*a, h);
+        for (const auto* a : { &t.e1xh, &t.e1yh, &t.e1zh, &t.e2xh, &t.e2yh, &t.e2zh }) h = hash_array(*a, h);
+        h = hash_array(t.n, h);
+        h = hash_array(t.mat, h);
+        for (const auto& m : s.materials) {
+            h = hash_floats({ m.alpha, m.ambient[0], m.ambient[1], m.ambient[2], m.diff[0], m.diff[1], m.diff[2],
+                m.spec[0], m.spec[1], m.spec[2], m.n, m.r }, h);
+        }
+        for (const auto& l : s.lights) {
+            h = hash_floats({ l.pos[0], l.pos[1], l.pos[2], l.color[0], l.color[1], l.color[2] }, h);
+        }
+        for (const auto& inst : s.instances) {
+            h = hash_bytes(&inst.world_to_object, sizeof(inst.world_to_object), h);
+            h = hash_bytes(&inst.mat, sizeof(inst.mat), h);
+            h = hash_scene(*inst.geometry, h);
+        }
+        return h;
+    }
+
+    // What the reference depends on: the scene's primitives, materials and
+    // lights, the view and the settings it is rendered with. Compared with
+    // the key stored next to a cached reference, so a reference of another
+    // scene is never taken for this one.
+    uint64_t reference_key(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& r) {
+        auto h = hash_scene(s, 14695981039346656037ull);
+        for (const auto& corner : { genvec::ivec2{ 0, 0 }, genvec::ivec2{ size[0] - 1, 0 }, genvec::ivec2{ 0, size[1] - 1 } }) {
+            const auto through = c.castRay(corner[0], corner[1]);
+            h = hash_floats({ through.e[0], through.e[1], through.e[2], through.dir[0], through.dir[1], through.dir[2] }, h);
+        }
+        const int ints[] = { size[0], size[1], r.max_depth, r.reflection_samples, r.shadow_samples, r.shadow_min_samples,
+            static_cast<int>(r.pattern), r.max_exact_lights, r.pixel_samples, r.max_pixel_samples };
+        h = hash_bytes(ints, sizeof(ints), h);
+        return hash_floats({ r.reflection_spread, r.shadow_spread, r.shadow_variance, r.roulette_weight, r.throughput_cutoff,
+            r.pixel_error, r.sample_budget }, h);
+    }
+
+    std::string hex(uint64_t v) {
+        auto out = std::ostringstream();
+        out << std::hex << std::setw(16) << std::setfill('0') << v;
+        return out.str();
+    }
+
+    // the key a reference was rendered with, in <path>.key
+    bool read_key(const std::string& path, std::string& key) {
+        auto in = std::ifstream(path + ".key");
+        return static_cast<bool>(in >> key);
+    }
+}
+
+std::vector<convergence_config> convergence_configs(const render_settings& base)
+{
+    auto configs = std::vector<convergence_config>{ { "base", base } };
+    auto with = [&](std::string name, auto change) {
+        auto settings = base;
+        change(settings);
+        configs.push_back(convergence_config{ std::move(name), settings });
+    };
+
+    for (auto pattern : { sample_pattern::random, sample_pattern::stratified, sample_pattern::sobol, sample_pattern::blue_noise }) {
+        if (pattern == base.pattern) continue;
+        with(std::string("sampler ") + sample_pattern_name(pattern), [&](render_settings& s) { s.pattern = pattern; });
+    }
+    with("shadow samples / 4", [](render_settings& s) { s.shadow_samples = std::max(1, s.shadow_samples / 4); });
+    with("shadow samples * 2", [](render_settings& s) { s.shadow_samples *= 2; });
+    with("depth 3", [](render_settings& s) { s.max_depth = std::min(s.max_depth, 3); });
+    // the spread only matters with several reflection samples
+    with("reflection spread / 4", [](render_settings& s) {
+        s.reflection_samples = std::max(s.reflection_samples, 4);
+        s.reflection_spread /= 4;
+    });
+    with("no roulette", [](render_settings& s) { s.roulette_weight = 0; s.throughput_cutoff = 0; });
+    with("no shadow early stop", [](render_settings& s) { s.shadow_variance = 0; });
+    return configs;
+}
+
+bool run_convergence(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& base, const progressive_settings& progressive, uint64_t seed, tile_scheduler& scheduler, const convergence_settings& settings)
+{
+    // nothing cancels the runs, they have to end by themselves
+    if (progressive.passes == 0 && progressive.time_limit <= 0) {
+        std::cout << "--converge with --passes 0 needs a --time-limit, otherwise every configuration refines forever" << std::endl;
+        return false;
+    }
+
+    const auto pixels = size[0] * size[1];
+    auto ref_settings = base;
+    ref_settings.pixel_samples = ref_settings.max_pixel_samples = std::max(1, settings.reference_samples);
+    ref_settings.shadow_variance = 0;
+    ref_settings.pattern = sample_pattern::sobol;
+    const auto key = hex(reference_key(s, c, size, ref_settings));
+
+    auto path = settings.reference;
+    if (path.empty()) {
+        path = "reference_" + std::to_string(size[0]) + "x" + std::to_string(size[1]) + "_" + std::to_string(settings.reference_samples) + "spp_" + key.substr(0, 8) + ".pfm";
+    }
+
+    // a .ppm comes from elsewhere and has no key; a .pfm has to match this
+    // scene, view and settings
+    auto stored = std::string();
+    const auto exists = static_cast<bool>(std::ifstream(path));
+    if (exists && !ends_with(path, ".ppm") && (!read_key(path, stored) || stored != key)) {
+        std::cout << path << " was rendered for another scene, view or settings (key " << (stored.empty() ? "missing" : stored)
+            << ", this run " << key << "); delete it or pick another --reference" << std::endl;
+        return false;
+    }
+
+    auto ref = reference_image{};
+    if (load_reference(path, size, ref)) {
+        std::cout << "reference: " << path << std::endl;
+    }
+    else if (ends_with(path, ".ppm") || exists) {
+        std::cout << "no usable reference in " << path << std::endl;
+        return false;
+    }
+    else {
+        std::cout << "rendering the reference, " << ref_settings.pixel_samples << " samples per pixel" << std::endl;
+        const auto start = steady_clock::now();
+        auto counts = ray_counts{};
+        auto aux = aux_buffers{};
+        auto costs = cost_map{};
+        ref.img.assign(pixels, rgb{ 0,0,0 });
+        render_supersampled(s, c, size, ref_settings, seed, scheduler, ref.img, counts, aux, costs);
+        std::cout << "reference took " << std::chrono::duration<double>(steady_clock::now() - start).count() << " s, cached in " << path << std::endl;
+
+        // rgb may be padded to four floats
+        auto floats = std::vector<float>(pixels * 3);
+        for (auto i = 0; i < pixels; i++) {
+            for (auto k = 0; k < 3; k++) {
+                floats[i * 3 + k] = ref.img[i][k];
+            }
+        }
+        simplePPM_write_pfm(path.c_str(), size[0], size[1], 3, floats.data());
+        std::ofstream(path + ".key") << key << std::endl;
+        ref.scale = normalize(ref.img);
+    }
+
+    auto csv = std::ofstream(settings.table);
+    csv << "config,step,seconds,rmse,psnr" << std::endl;
+
+    // every pass ends in a snapshot
+    auto pass_settings = progressive;
+    pass_settings.snapshot_interval = 1e-9;
+
+    struct row {
+        std::string step;
+        double seconds, rmse;
+    };
+    struct result {
+        std::string name;
+        row last;
+    };
+    auto results = std::vector<result>();
+    std::atomic<bool> not_cancelled{ false };
+
+    // one framebuffer for every run
+    auto img = std::vector<rgb>(pixels);
+    for (const auto& config : convergence_configs(base)) {
+        std::cout << std::endl << "== " << config.name << std::endl;
+        auto rows = std::vector<row>();
+        std::fill(img.begin(), img.end(), rgb{ 0,0,0 });
+        auto counts = ray_counts{};
+        auto aux = aux_buffers{};
+        auto costs = cost_map{};
+
+        const auto start = steady_clock::now();
+        auto step = 0;
+        auto snapshot = [&](const std::vector<rgb>& partial) {
+            const auto seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+            // the preview passes come first
+            const auto preview = progressive.preview ? 3 : 0;
+            const auto name = step < preview ? "preview " + std::to_string(8 >> step) : "pass " + std::to_string(step - preview + 1);
+            rows.push_back(row{ name, seconds, rmse(partial, ref) });
+            step++;
+        };
+        render_progressive(s, c, size, config.settings, seed, scheduler, pass_settings, not_cancelled, snapshot, img, counts, aux, costs);
+
+        const auto flags = std::cout.flags();
+        std::cout << std::left << std::setw(14) << "step" << std::right << std::setw(10) << "seconds" << std::setw(12) << "rmse" << std::setw(10) << "psnr" << std::endl;
+        std::cout << std::fixed;
+        for (const auto& r : rows) {
+            std::cout << std::left << std::setw(14) << r.step << std::right << std::setprecision(3) << std::setw(10) << r.seconds
+                << std::setprecision(5) << std::setw(12) << r.rmse << std::setprecision(2) << std::setw(10) << psnr(r.rmse) << std::endl;
+            csv << '"' << config.name << "\"," << r.step << "," << r.seconds << "," << r.rmse << "," << psnr(r.rmse) << std::endl;
+        }
+        std::cout.flags(flags);
+        if (!rows.empty())
+            results.push_back(result{ config.name, rows.back() });
+    }
+
+    std::cout << std::endl << std::left << std::setw(26) << "config" << std::right << std::setw(10) << "seconds" << std::setw(12) << "rmse" << std::setw(10) << "psnr" << std::endl;
+    std::cout << std::fixed;
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(26) << r.name << std::right << std::setprecision(3) << std::setw(10) << r.last.seconds
+            << std::setprecision(5) << std::setw(12) << r.last.rmse << std::setprecision(2) << std::setw(10) << psnr(r.last.rmse) << std::endl;
+    }
+    std::cout << std::defaultfloat << "rows in " << settings.table << std::endl;
+    return true;
+}
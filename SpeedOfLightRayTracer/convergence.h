@@ -0,0 +1,44 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "scene.h"
+#include "render_settings.h"
+#include "scheduler.h"
+#include "progressive.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct convergence_settings
+{
+    std::string reference;        // cache file, .pfm; a .ppm is read but never written. empty = named by size, samples and key
+    int reference_samples = 32;   // jittered samples per pixel of the reference
+    std::string table = "convergence.csv";
+};
+
+struct convergence_config
+{
+    std::string name;
+    render_settings settings;
+};
+
+// base itself, then base with one thing changed: every sampler, a quarter
+// and twice the shadow samples, depth 3, four reflection samples at a
+// quarter of the reflection spread, no roulette and no early stop of the
+// shadow rays
+std::vector<convergence_config> convergence_configs(const render_settings& base);
+
+// Compares ways of rendering against a reference image. The reference is
+// base with settings.reference_samples jittered samples per pixel and
+// every shadow ray traced, rendered once and cached as float RGB in a PFM
+// file. <file>.key next to it holds a hash of the scene, the view and the
+// reference settings, and a cached reference with another key is refused.
+// Every configuration is then rendered progressively, and after every pass
+// the RMSE and PSNR of the image so far against the reference are taken,
+// in units of the reference's brightest pixel like the tone mapping does.
+// A PPM reference (say from another renderer) has no key and is compared
+// with the image tone mapped by its own brightest pixel instead. Prints a
+// table per configuration and writes all rows to settings.table as CSV.
+// Nothing cancels the runs, so progressive needs passes or a time limit;
+// false when it has neither or there is no usable reference.
+bool run_convergence(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& base, const progressive_settings& progressive, uint64_t seed, tile_scheduler& scheduler, const convergence_settings& settings);
@@ -0,0 +1,147 @@
+#include "stdafx.h"
+#include "denoise.h"
+#include "profiler.h"
+#include "arena.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // depth of a miss; finite so that two misses differ by 0, not NaN
+    const float miss_depth = 1e30f;
+
+    // B3 spline, the a-trous kernel along one axis
+    const float kernel[5] = { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+
+    // one float plane per channel, rows of width floats
+    struct planes3 {
+        explicit planes3(size_t n) : c{ std::vector<float>(n), std::vector<float>(n), std::vector<float>(n) } {}
+        std::vector<float> c[3];
+    };
+
+    template<typename V>
+    planes3 split(const std::vector<V>& v, float scale) {
+        auto p = planes3(v.size());
+        for (size_t i = 0; i < v.size(); i++) {
+            for (auto k = 0; k < 3; k++) {
+                p.c[k][i] = v[i][k] * scale;
+            }
+        }
+        return p;
+    }
+
+    // one filter pass from src into dst
+    void atrous_pass(const planes3& src, planes3& dst, const planes3& albedo, const planes3& normal, const std::vector<float>& depth, const genvec::ivec2& size, int stride, float sigma_color, const denoise_settings& settings) {
+        const auto w = size[0], h = size[1];
+        const auto color_falloff = 1 / (sigma_color * sigma_color);
+        const auto albedo_falloff = 1 / (settings.sigma_albedo * settings.sigma_albedo);
+        const auto normal_falloff = settings.normal_sharpness;
+
+#pragma omp parallel
+        {
+            // per thread: the sums for a row and the centre depth falloff, from
+            // the thread's arena, which keeps them for the next pass
+            auto& scratch = scratch_arena();
+            const arena::scope rows(scratch);
+            float* sr = scratch.alloc<float>(w); float* sg = scratch.alloc<float>(w); float* sb = scratch.alloc<float>(w);
+            float* sw = scratch.alloc<float>(w);
+            float* dz = scratch.alloc<float>(w);
+
+#pragma omp for schedule(dynamic, 4)
+            for (auto y = 0; y < h; y++) {
+                PROFILE_SCOPE("denoise row", y);
+                const auto row = static_cast<size_t>(y) * w;
+                const float* cr = &src.c[0][row]; const float* cg = &src.c[1][row]; const float* cb = &src.c[2][row];
+                const float* ar = &albedo.c[0][row]; const float* ag = &albedo.c[1][row]; const float* ab = &albedo.c[2][row];
+                const float* nx = &normal.c[0][row]; const float* ny = &normal.c[1][row]; const float* nz = &normal.c[2][row];
+                const float* z = &depth[row];
+
+                for (auto x = 0; x < w; x++) {
+                    sr[x] = sg[x] = sb[x] = sw[x] = 0;
+                    dz[x] = 1 / (settings.sigma_depth * stride * std::max(z[x], 1e-3f));
+                }
+
+                for (auto ky = -2; ky <= 2; ky++) {
+                    const auto yy = y + ky * stride;
+                    if (yy < 0 || yy >= h) continue;
+                    for (auto kx = -2; kx <= 2; kx++) {
+                        const auto dx = kx * stride;
+                        const auto x0 = std::max(0, -dx), x1 = std::min(w, w - dx);
+                        const auto k = kernel[ky + 2] * kernel[kx + 2];
+                        const auto tap = static_cast<size_t>(yy) * w;
+                        const float* qr = &src.c[0][tap]; const float* qg = &src.c[1][tap]; const float* qb = &src.c[2][tap];
+                        const float* pr = &albedo.c[0][tap]; const float* pg = &albedo.c[1][tap]; const float* pb = &albedo.c[2][tap];
+                        const float* mx = &normal.c[0][tap]; const float* my = &normal.c[1][tap]; const float* mz = &normal.c[2][tap];
+                        const float* qz = &depth[tap];
+
+                        // no branches in here, so the compiler can vectorize it
+                        for (auto x = x0; x < x1; x++) {
+                            const auto t = x + dx;
+                            const auto er = cr[x] - qr[t], eg = cg[x] - qg[t], eb = cb[x] - qb[t];
+                            const auto fr = ar[x] - pr[t], fg = ag[x] - pg[t], fb = ab[x] - pb[t];
+                            const auto cosine = nx[x] * mx[t] + ny[x] * my[t] + nz[x] * mz[t];
+                            const auto e = (er*er + eg*eg + eb*eb) * color_falloff
+                                + (fr*fr + fg*fg + fb*fb) * albedo_falloff
+                                + (1 - cosine) * normal_falloff
+                                + std::abs(z[x] - qz[t]) * dz[x];
+                            const auto wt = k * std::exp(-e);
+                            sr[x] += wt * qr[t];
+                            sg[x] += wt * qg[t];
+                            sb[x] += wt * qb[t];
+                            sw[x] += wt;
+                        }
+                    }
+                }
+
+                // the centre tap always has weight, so sw > 0
+                for (auto x = 0; x < w; x++) {
+                    dst.c[0][row + x] = sr[x] / sw[x];
+                    dst.c[1][row + x] = sg[x] / sw[x];
+                    dst.c[2][row + x] = sb[x] / sw[x];
+                }
+            }
+        }
+    }
+}
+
+void aux_buffers::record(size_t pixel, const ray& r, const std::pair<material const*, intersection>& hit)
+{
+    if (!enabled()) return;
+
+    if (!hit.first) {
+        albedo[pixel] = r.dir.abs();
+        normal[pixel] = fvec3{ 0,0,0 };
+        depth[pixel] = miss_depth;
+        return;
+    }
+    albedo[pixel] = hit.first->diff.abs();
+    normal[pixel] = hit.second.n;
+    depth[pixel] = hit.second.d * r.dir.len();
+}
+
+void denoise(std::vector<rgb>& img, const aux_buffers& aux, const genvec::ivec2& size, const denoise_settings& settings)
+{
+    if (!aux.enabled() || img.empty()) return;
+
+    // colours in units of the brightest pixel, like the tone mapping
+    auto max = 0.f;
+    for (const auto& col : img) {
+        max = std::max(max, col.len());
+    }
+    if (max <= 0) return;
+
+    auto a = split(img, 1 / max);
+    auto b = planes3(img.size());
+    const auto albedo = split(aux.albedo, 1.f);
+    const auto normal = split(aux.normal, 1.f);
+
+    auto sigma_color = settings.sigma_color;
+    for (auto i = 0; i < settings.iterations; i++) {
+        atrous_pass(a, b, albedo, normal, aux.depth, size, 1 << i, sigma_color, settings);
+        std::swap(a, b);
+        sigma_color *= .5f;
+    }
+
+    for (size_t i = 0; i < img.size(); i++) {
+        img[i] = rgb{ a.c[0][i], a.c[1][i], a.c[2][i] } * max;
+    }
+}
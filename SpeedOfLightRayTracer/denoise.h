@@ -0,0 +1,46 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "material.h"
+#include "intersection.h"
+#include <vector>
+#include <utility>
+
+using genvec::rgb;
+using genvec::fvec3;
+
+// What the camera ray of every pixel hit, for guiding the denoiser: the
+// diffuse colour, the normal and the distance. Misses keep the background
+// colour as albedo, a zero normal and a huge depth. Empty unless
+// allocated, until then record does nothing.
+struct aux_buffers
+{
+    aux_buffers() {}
+    explicit aux_buffers(size_t pixels)
+        : albedo(pixels), normal(pixels), depth(pixels) {}
+
+    bool enabled() const { return !depth.empty(); }
+    void record(size_t pixel, const ray& r, const std::pair<material const*, intersection>& hit);
+
+    std::vector<rgb> albedo;
+    std::vector<fvec3> normal;
+    std::vector<float> depth;
+};
+
+struct denoise_settings
+{
+    int iterations = 5;           // filter passes, the tap stride doubles every pass
+    float sigma_color = .1f;      // colour difference in units of the brightest pixel, halved every pass
+    float sigma_albedo = .1f;     // albedo difference
+    float normal_sharpness = 32;  // weight falls off as exp(-normal_sharpness * (1 - dot(n, n')))
+    float sigma_depth = .02f;     // depth difference relative to the depth, per pixel of stride
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) over img, in
+// place. Every pass blurs with a 5x5 B3 spline kernel whose taps are
+// 2^pass pixels apart, weighing every tap down by how much its colour,
+// albedo, normal and depth differ from the centre pixel's, so shadows and
+// glossy reflections are smoothed but object and material edges are not.
+// Works on planar float copies of the buffers; rows run in parallel and
+// the loop over a row has no branches, so it vectorizes.
+void denoise(std::vector<rgb>& img, const aux_buffers& aux, const genvec::ivec2& size, const denoise_settings& settings);
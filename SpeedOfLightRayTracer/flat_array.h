@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+
+// A contiguous array of plain data that either owns its elements, like a
+// std::vector, or is a read only view of memory someone else owns, such as
+// a mapped scene cache (see scene_file.h). Reads go through one pointer
+// whichever it is; anything that writes turns a view into an owned copy
+// first. The owner of viewed memory has to outlive the array.
+template<typename T>
+class flat_array
+{
+    static_assert(std::is_trivially_copyable<T>::value, "flat_array views raw memory");
+
+public:
+    flat_array() {}
+    flat_array(const flat_array& other) : owned(other.ptr, other.ptr + other.count) { sync(); }
+    flat_array(flat_array&& other) : owned(std::move(other.owned)), view(other.view) {
+        if (view) { ptr = other.ptr; count = other.count; }
+        else sync();
+        other.clear();
+    }
+    flat_array& operator=(flat_array other) {
+        swap(other);
+        return *this;
+    }
+
+    static flat_array view_of(const T* data, size_t n) {
+        auto a = flat_array();
+        a.view = true;
+        a.ptr = data;
+        a.count = n;
+        return a;
+    }
+
+    bool is_view() const { return view; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const T* data() const { return ptr; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+    const T& back() const { return ptr[count - 1]; }
+
+    T* data() { own(); return owned.data(); }
+    T& operator[](size_t i) { own(); return owned[i]; }
+
+    void push_back(const T& v) { own(); owned.push_back(v); sync(); }
+    template<typename... Args>
+    void emplace_back(Args&&... args) { own(); owned.emplace_back(std::forward<Args>(args)...); sync(); }
+    void resize(size_t n) { own(); owned.resize(n); sync(); }
+    void resize(size_t n, const T& v) { own(); owned.resize(n, v); sync(); }
+    void reserve(size_t n) { own(); owned.reserve(n); sync(); }
+    void clear() { owned.clear(); view = false; sync(); }
+
+    void swap(flat_array& other) {
+        owned.swap(other.owned);
+        std::swap(view, other.view);
+        std::swap(ptr, other.ptr);
+        std::swap(count, other.count);
+    }
+
+private:
+    void own() {
+        if (!view) return;
+        owned.assign(ptr, ptr + count);
+        view = false;
+        sync();
+    }
+    void sync() {
+        ptr = owned.data();
+        count = owned.size();
+    }
+
+    std::vector<T> owned;
+    bool view = false;
+    const T* ptr = nullptr;
+    size_t count = 0;
+};
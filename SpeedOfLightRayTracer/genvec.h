@@ -7,7 +7,8 @@
 
 
 namespace genvec {
-	template<typename T, size_t LEN>
+	// the third parameter only exists so genvec_simd.h can specialize on it
+	template<typename T, size_t LEN, typename = void>
 	class vec
 	{
 	private:
@@ -371,6 +372,10 @@ namespace genvec {
 	}
 }
 
+#if !defined(GENVEC_NO_SIMD) && (defined(_M_X64) || defined(__x86_64__))
+#include "genvec_simd.h"
+#endif
+
 template<typename T, int N>
 std::ostream& operator<<(std::ostream& o, const genvec::vec<T, N>& v) {
     o << v.str();
@@ -0,0 +1,281 @@
+#pragma once
+
+// SSE specializations of vec<float, 3> and vec<float, 4>, included from
+// genvec.h. Both keep the generic public API; the 3 component version
+// carries a fourth lane that is never read by reductions or comparisons.
+//
+// define GENVEC_NO_SIMD to fall back to the generic template
+// define GENVEC_FAST_NORMALIZE to make normalized() use rsqrt plus one
+// Newton-Raphson step (about 22 bits) instead of sqrt and divide
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <sstream>
+#include <type_traits>
+
+namespace genvec {
+	namespace detail {
+		inline __m128 hsum(__m128 v, std::integral_constant<size_t, 3>) {
+			auto y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+			auto z = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+			auto s = _mm_add_ss(_mm_add_ss(v, y), z);
+			return _mm_shuffle_ps(s, s, 0);
+		}
+
+		inline __m128 hsum(__m128 v, std::integral_constant<size_t, 4>) {
+			auto s = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+		}
+
+		// dot product broadcast to every lane. Shuffles beat _mm_dp_ps here,
+		// which has a much longer latency on current cores.
+		template<size_t LEN>
+		inline __m128 dot_splat(__m128 a, __m128 b) {
+			return hsum(_mm_mul_ps(a, b), std::integral_constant<size_t, LEN>());
+		}
+	}
+
+	template<size_t LEN>
+	class vec<float, LEN, std::enable_if_t<LEN == 3 || LEN == 4>>
+	{
+	private:
+		using self = vec<float, LEN>;
+
+		union {
+			__m128 m;
+			float arr[4];
+		};
+
+		inline void set() { m = _mm_setzero_ps(); }
+		inline void set(float x, float y, float z) { m = _mm_set_ps(0, z, y, x); }
+		inline void set(float x, float y, float z, float w) { m = _mm_set_ps(w, z, y, x); }
+
+		// componentwise fallback for mixed types, matches the generic template
+		template<typename TT, typename Op>
+		inline auto zip(const vec<TT, LEN>& v, Op op) const {
+			vec<decltype(op(float(), TT())), LEN> res;
+			for (size_t i = 0; i < LEN; i++) {
+				res[i] = op(arr[i], v[i]);
+			}
+			return res;
+		}
+
+		template<typename TT, typename Op>
+		inline auto each(const TT& c, Op op) const {
+			vec<decltype(op(float(), TT())), LEN> res;
+			for (size_t i = 0; i < LEN; i++) {
+				res[i] = op(arr[i], c);
+			}
+			return res;
+		}
+
+		template<typename TT>
+		using is_float_result = std::integral_constant<bool, std::is_arithmetic<TT>::value && std::is_same<decltype(float() * TT()), float>::value>;
+
+	public:
+		template<typename... Ts>
+		vec(Ts... t)
+		{
+			static_assert(LEN >= sizeof...(Ts), "Cannot assign to more elements than exist in the vector!");
+			static_assert(sizeof...(Ts) == 0 || sizeof...(Ts) == LEN, "Must assign to all or no elements of a vector");
+			set(static_cast<float>(t)...);
+		}
+
+		vec(std::function<float()> f)
+		{
+			m = _mm_setzero_ps();
+			for (size_t i = 0; i < LEN; i++) {
+				arr[i] = f();
+			}
+		}
+
+		explicit vec(__m128 m) : m(m) {}
+
+		inline __m128 simd() const { return m; }
+
+		inline float& operator[](const size_t idx) {
+			return arr[idx];
+		}
+
+		inline const float& operator[](const size_t idx) const {
+			return arr[idx];
+		}
+
+		inline float lensq() const {
+			return _mm_cvtss_f32(detail::dot_splat<LEN>(m, m));
+		}
+
+		inline float len() const {
+			return _mm_cvtss_f32(_mm_sqrt_ss(detail::dot_splat<LEN>(m, m)));
+		}
+
+		inline self normalized() const {
+#ifdef GENVEC_FAST_NORMALIZE
+			return fast_normalized();
+#else
+			return self(_mm_div_ps(m, _mm_sqrt_ps(detail::dot_splat<LEN>(m, m))));
+#endif
+		}
+
+		// rsqrt estimate refined by one Newton-Raphson step
+		inline self fast_normalized() const {
+			auto lsq = detail::dot_splat<LEN>(m, m);
+			auto y = _mm_rsqrt_ps(lsq);
+			auto yyx = _mm_mul_ps(_mm_mul_ps(y, y), lsq);
+			y = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(.5f), y), _mm_sub_ps(_mm_set1_ps(3.f), yyx));
+			return self(_mm_mul_ps(m, y));
+		}
+
+		inline self operator*(const self& v) const { return self(_mm_mul_ps(m, v.simd())); }
+		inline self operator+(const self& v) const { return self(_mm_add_ps(m, v.simd())); }
+		inline self operator-(const self& v) const { return self(_mm_sub_ps(m, v.simd())); }
+		inline self operator/(const self& v) const { return self(_mm_div_ps(m, v.simd())); }
+
+		template<typename TT>
+		inline auto operator*(const vec<TT, LEN>& v) const { return zip(v, [](float a, TT b) { return a * b; }); }
+		template<typename TT>
+		inline auto operator+(const vec<TT, LEN>& v) const { return zip(v, [](float a, TT b) { return a + b; }); }
+		template<typename TT>
+		inline auto operator-(const vec<TT, LEN>& v) const { return zip(v, [](float a, TT b) { return a - b; }); }
+		template<typename TT>
+		inline auto operator/(const vec<TT, LEN>& v) const { return zip(v, [](float a, TT b) { return a / b; }); }
+
+		template<typename TT, typename = std::enable_if_t<is_float_result<TT>::value>>
+		inline self operator*(const TT& c) const { return self(_mm_mul_ps(m, _mm_set1_ps(static_cast<float>(c)))); }
+		template<typename TT, typename = std::enable_if_t<is_float_result<TT>::value>>
+		inline self operator+(const TT& c) const { return self(_mm_add_ps(m, _mm_set1_ps(static_cast<float>(c)))); }
+		template<typename TT, typename = std::enable_if_t<is_float_result<TT>::value>>
+		inline self operator-(const TT& c) const { return self(_mm_sub_ps(m, _mm_set1_ps(static_cast<float>(c)))); }
+		template<typename TT, typename = std::enable_if_t<is_float_result<TT>::value>>
+		inline self operator/(const TT& c) const { return self(_mm_div_ps(m, _mm_set1_ps(static_cast<float>(c)))); }
+
+		// scalars that promote (double, long double) keep the generic behaviour
+		template<typename TT, typename = std::enable_if_t<std::is_arithmetic<TT>::value && !is_float_result<TT>::value>, typename = void>
+		inline auto operator*(const TT& c) const { return each(c, [](float a, TT b) { return a * b; }); }
+		template<typename TT, typename = std::enable_if_t<std::is_arithmetic<TT>::value && !is_float_result<TT>::value>, typename = void>
+		inline auto operator+(const TT& c) const { return each(c, [](float a, TT b) { return a + b; }); }
+		template<typename TT, typename = std::enable_if_t<std::is_arithmetic<TT>::value && !is_float_result<TT>::value>, typename = void>
+		inline auto operator-(const TT& c) const { return each(c, [](float a, TT b) { return a - b; }); }
+		template<typename TT, typename = std::enable_if_t<std::is_arithmetic<TT>::value && !is_float_result<TT>::value>, typename = void>
+		inline auto operator/(const TT& c) const { return each(c, [](float a, TT b) { return a / b; }); }
+
+		template<typename TT, typename = std::enable_if_t<std::is_arithmetic<TT>::value>>
+		inline auto& operator=(const TT& c) {
+			m = _mm_set1_ps(static_cast<float>(c));
+			return *this;
+		}
+
+		template<typename TT>
+		inline auto& operator=(const vec<TT, LEN>& v) {
+			for (size_t i = 0; i < LEN; i++) {
+				arr[i] = static_cast<float>(v[i]);
+			}
+			return *this;
+		}
+
+		template<typename TT, typename = std::enable_if_t<std::is_arithmetic<TT>::value>>
+		inline bool operator==(const TT& c) const {
+			const auto mask = (1 << LEN) - 1;
+			return (_mm_movemask_ps(_mm_cmpeq_ps(m, _mm_set1_ps(static_cast<float>(c)))) & mask) == mask;
+		}
+
+		inline bool operator==(const self& v) const {
+			const auto mask = (1 << LEN) - 1;
+			return (_mm_movemask_ps(_mm_cmpeq_ps(m, v.simd())) & mask) == mask;
+		}
+
+		template<typename TT>
+		inline bool operator==(const vec<TT, LEN>& v) const {
+			for (size_t i = 0; i < LEN; i++)
+				if (arr[i] != v[i])
+					return false;
+
+			return true;
+		}
+
+		template<typename TT>
+		inline bool operator!=(const TT& c) const {
+			return !(*this == c);
+		}
+
+		template<typename TT>
+		inline auto& operator+=(const TT& v) {
+			(*this) = (*this) + v;
+			return *this;
+		}
+
+		template<typename TT>
+		inline auto& operator-=(const TT& v) {
+			(*this) = (*this) - v;
+			return *this;
+		}
+
+		template<typename TT>
+		inline auto& operator/=(const TT& v) {
+			(*this) = (*this) / v;
+			return *this;
+		}
+
+		template<typename TT>
+		inline auto& operator*=(const TT& v) {
+			(*this) = (*this) * v;
+			return *this;
+		}
+
+		template<size_t... IDXs>
+		inline auto swizzle() {
+			static_assert(sizeof...(IDXs) > 0, "swizzle requires more than one index");
+			return vec<float, sizeof...(IDXs)> { arr[check_index<IDXs>()]... };
+		}
+
+		self abs() const {
+			return self(_mm_andnot_ps(_mm_set1_ps(-0.f), m));
+		}
+
+		auto str() const {
+			std::stringstream s;
+			s << '(';
+			for (size_t i = 0; i < LEN - 1; i++) {
+				s << arr[i] << ',' << ' ';
+			}
+			s << arr[LEN - 1] << ')';
+			return s.str();
+		}
+
+		auto all_unit() const {
+			auto max = arr[0];
+			for (size_t i = 0; i < LEN; i++) {
+				max = std::max(max, arr[i]);
+			}
+			return (*this) / max;
+		}
+
+		auto sum() const {
+			return _mm_cvtss_f32(detail::hsum(m, std::integral_constant<size_t, LEN>()));
+		}
+
+	private:
+		template<size_t idx>
+		static constexpr size_t check_index() {
+			static_assert(idx < LEN, "Invalid index");
+			return idx;
+		}
+	};
+
+	inline float dot(const vec<float, 3>& u, const vec<float, 3>& v) {
+		return _mm_cvtss_f32(detail::dot_splat<3>(u.simd(), v.simd()));
+	}
+
+	inline float dot(const vec<float, 4>& u, const vec<float, 4>& v) {
+		return _mm_cvtss_f32(detail::dot_splat<4>(u.simd(), v.simd()));
+	}
+
+	inline vec<float, 3> cross(const vec<float, 3>& u, const vec<float, 3>& v) {
+		auto a = u.simd();
+		auto b = v.simd();
+		auto a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+		auto b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+		auto c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+		return vec<float, 3>(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+	}
+}
@@ -0,0 +1,68 @@
+#include "stdafx.h"
+#include "heatmap.h"
+#include "simplePPM.h"
+#include <algorithm>
+#include <string>
+
+namespace {
+    // black through purple, red and yellow to white
+    const float ramp[5][3] = {
+        { 0, 0, 0 }, { .3f, 0, .5f }, { .9f, .2f, .1f }, { 1, .8f, 0 }, { 1, 1, 1 },
+    };
+
+    void write_map(const std::string& path, const std::vector<float>& values, const genvec::ivec2& size, const char* unit) {
+        auto sorted = values;
+        const auto p99 = sorted.begin() + sorted.size() * 99 / 100;
+        std::nth_element(sorted.begin(), p99, sorted.end());
+        const auto scale = *p99 > 0 ? *p99 : 1.f;
+
+        auto sum = 0.;
+        auto most = 0.f;
+        auto rgb = std::vector<unsigned char>(values.size() * 3);
+        for (size_t i = 0; i < values.size(); i++) {
+            sum += values[i];
+            most = std::max(most, values[i]);
+            const auto t = std::min(1.f, values[i] / scale) * 4;
+            const auto k = std::min(3, static_cast<int>(t));
+            const auto f = t - k;
+            for (auto c = 0; c < 3; c++) {
+                rgb[i * 3 + c] = static_cast<unsigned char>((ramp[k][c] + (ramp[k + 1][c] - ramp[k][c]) * f) * 255);
+            }
+        }
+        std::cout << path << ": " << sum / values.size() << " " << unit << " per pixel on average, "
+            << *p99 << " at the 99th percentile (white), " << most << " most" << std::endl;
+
+        simplePPM_write_ppm((path + ".ppm").c_str(), size[0], size[1], rgb.data());
+        simplePPM_write_pfm((path + ".pfm").c_str(), size[0], size[1], 1, values.data());
+    }
+}
+
+cost_map::mark cost_map::now() const
+{
+    if (!enabled()) return mark{ 0, 0, 0 };
+
+    const auto& c = profiler::local().counters;
+    return mark{
+        c[profiler::primary_rays] + c[profiler::reflection_rays] + c[profiler::shadow_rays],
+        c[profiler::sphere_tests] + c[profiler::triangle_tests],
+        profiler::now_ns(),
+    };
+}
+
+void cost_map::add(size_t pixel, const mark& from, const mark& to, float share)
+{
+    if (!enabled()) return;
+
+    rays[pixel] += (to.rays - from.rays) * share;
+    tests[pixel] += (to.tests - from.tests) * share;
+    nanoseconds[pixel] += (to.ns - from.ns) * share;
+}
+
+void cost_map::write(const char* prefix, const genvec::ivec2& size) const
+{
+    if (!enabled()) return;
+
+    write_map(std::string(prefix) + "_rays", rays, size, "rays");
+    write_map(std::string(prefix) + "_tests", tests, size, "tests");
+    write_map(std::string(prefix) + "_time", nanoseconds, size, "ns");
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "genvec.h"
+#include "profiler.h"
+#include <vector>
+#include <cstdint>
+
+// What every pixel cost: the rays it traced, its ray against primitive
+// tests and the nanoseconds its samples took, summed over all of them.
+// Rays and tests are the differences of the profiler's counters on the
+// thread that renders the pixel, so they need profiler::start() and are
+// zero with SOL_NO_PROFILE. Time is the whole sample, shading included;
+// timing every scene query on its own would cost more than the queries.
+// Empty unless allocated, until then mark and add do nothing.
+struct cost_map
+{
+    // the current thread's counters and clock
+    struct mark {
+        uint64_t rays, tests;
+        int64_t ns;
+    };
+
+    cost_map() {}
+    explicit cost_map(size_t pixels)
+        : rays(pixels), tests(pixels), nanoseconds(pixels) {}
+
+    bool enabled() const { return !nanoseconds.empty(); }
+    mark now() const;
+    // adds share of what was spent between from and to to the pixel; a
+    // packet's primary rays are shared out over its pixels
+    void add(size_t pixel, const mark& from, const mark& to, float share = 1);
+
+    // <prefix>_rays, _tests and _time, each as a false colour .ppm scaled
+    // to the 99th percentile and as a one channel .pfm of the raw values
+    void write(const char* prefix, const genvec::ivec2& size) const;
+
+    std::vector<float> rays;
+    std::vector<float> tests;
+    std::vector<float> nanoseconds;
+};
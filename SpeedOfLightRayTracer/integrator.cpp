@@ -0,0 +1,293 @@
+#include "stdafx.h"
+#include "integrator.h"
+#include "profiler.h"
+#include <cmath>
+#include <algorithm>
+
+using genvec::dot;
+
+namespace {
+    // render_settings{} as compile time constants, keep the two in step
+    struct default_settings {
+        static const int max_depth = 10;
+        static const int reflection_samples = 1;
+        static const int shadow_samples = 100;
+        static constexpr float reflection_spread = 100;
+        static constexpr float shadow_spread = 20;
+        static const int shadow_min_samples = 16;
+        static constexpr float shadow_variance = .001f;
+        static const int max_exact_lights = 8;
+        static constexpr float roulette_weight = .05f;
+        static constexpr float throughput_cutoff = 1.f / 255;
+    };
+
+    // how many shadow rays a light gets at one surface, or with pick_lights
+    // the whole surface, each ray towards a light from the light tree
+    struct shadow_budget {
+        int samples;      // at most
+        int min_samples;  // batch size between checks
+        float variance;   // stop below this, 0 never stops early
+        bool pick_lights;
+    };
+
+    // what the bounce loop carries from one surface to the next
+    struct path_state {
+        pos origin;
+        fvec3 dir;
+        float weight;       // product of the reflectances so far, what the roulette looks at
+        float share;        // of the pixel, 1 / the reflection samples the path split into
+        int depth;          // surfaces hit before this one
+        int shadow_samples; // per light at the next surface
+    };
+
+    // decides whether a path with the given throughput goes on, and
+    // reweights the survivors of a roulette round
+    template<typename Settings>
+    bool survives(float& throughput, const Settings& settings, sampler& smp) {
+        const float roulette_weight = settings.roulette_weight;
+        const float throughput_cutoff = settings.throughput_cutoff;
+        if (throughput < throughput_cutoff)
+            return false;
+        if (throughput >= roulette_weight)
+            return true;
+
+        smp.start_set(1);
+        if (smp.next()[0] * roulette_weight >= throughput)
+            return false;
+        throughput = roulette_weight;
+        return true;
+    }
+
+    fvec3 mirror(const fvec3& dir, const fvec3& norm) {
+        return (dir - 2 * dot(dir, norm)*norm).normalized();
+    }
+
+    float luminance(const rgb& c) {
+        return .2126f * c[0] + .7152f * c[1] + .0722f * c[2];
+    }
+
+    // shadow rays that each pick a light from the light tree, plus the
+    // ambient term of every light; unbiased, every ray weighs its light's
+    // contribution by one over the pick probability
+    rgb picked_light(const scene& s, const pos& pos_of_intersect, const fvec3& norm, const fvec3& dir, const material& mat, const shadow_budget& budget, float shadow_spread, sampler& smp, uint64_t& shadow_rays) {
+        const auto samples = budget.samples;
+        const auto batch = std::max(1, std::min(budget.min_samples, samples));
+        auto sum = rgb{ 0,0,0 };
+        auto lum = 0.f, lum_sq = 0.f;
+        auto taken = 0;
+        smp.start_set(samples);
+        while (taken < samples) {
+            auto u = smp.next();
+            uint32_t index;
+            float pdf;
+            taken++;
+            if (s.light_bvh.pick(pos_of_intersect, norm, u[0], index, pdf)) {
+                const auto& light = s.lights[index];
+                const auto lit = lit_by(light, pos_of_intersect, norm, dir, mat);
+                if (lit[0] != 0 || lit[1] != 0 || lit[2] != 0) {
+                    auto dist_to_light = (light.pos - pos_of_intersect).len();
+                    auto l = (light.pos - pos_of_intersect).normalized();
+                    auto wiggle = (samples > 1) ? sphere_direction(u[0], u[1]) : fvec3{ 0,0,0 };
+                    auto ray_to_light = ray{ pos_of_intersect + (norm * .001f), (l * shadow_spread + wiggle).normalized() };
+                    shadow_rays++;
+                    if (!s.occluded(ray_to_light, dist_to_light)) {
+                        const auto c = lit / pdf;
+                        sum += c;
+                        lum += luminance(c);
+                        lum_sq += luminance(c) * luminance(c);
+                    }
+                }
+            }
+
+            if (budget.variance > 0 && taken % batch == 0 && taken < samples) {
+                // variance of the mean relative to its square
+                const auto mean = lum / taken;
+                const auto variance = std::max(0.f, lum_sq / taken - mean * mean) / taken;
+                if (mean == 0 || variance < budget.variance * mean * mean)
+                    break;
+            }
+        }
+        return mat.ambient.abs() * s.light_bvh.total_color + sum / static_cast<float>(taken);
+    }
+
+    // shadow samples towards every light plus the ambient term
+    rgb direct_light(const scene& s, const pos& pos_of_intersect, const fvec3& norm, const fvec3& dir, const material& mat, const shadow_budget& budget, float shadow_spread, sampler& smp, uint64_t& shadow_rays) {
+        if (budget.pick_lights)
+            return picked_light(s, pos_of_intersect, norm, dir, mat, budget, shadow_spread, smp, shadow_rays);
+
+        auto color = rgb{ 0,0,0 };
+        const auto samples = budget.samples;
+        const auto batch = std::max(1, std::min(budget.min_samples, samples));
+        for (const auto& light : s.lights) {
+            auto dist_to_light = (light.pos - pos_of_intersect).len();
+            auto l = (light.pos - pos_of_intersect).normalized();
+
+            auto ambient = light.color * mat.ambient;
+            color += ambient.abs();
+
+            auto lit = lit_by(light, pos_of_intersect, norm, dir, mat);
+            // lights behind the surface add nothing, no need to trace them
+            if (lit[0] == 0 && lit[1] == 0 && lit[2] == 0)
+                continue;
+
+            auto visible = 0;
+            auto taken = 0;
+            smp.start_set(samples);
+            while (taken < samples) {
+                auto u = smp.next();
+                auto wiggle = (samples > 1) ? sphere_direction(u[0], u[1]) : fvec3{ 0,0,0 };
+
+                auto ray_to_light = ray{ pos_of_intersect + (norm * .001f), (l * shadow_spread + wiggle).normalized() };
+                if (!s.occluded(ray_to_light, dist_to_light))
+                    visible++;
+                taken++;
+
+                if (budget.variance > 0 && taken % batch == 0 && taken < samples) {
+                    // variance of the visible fraction as an estimate of the mean
+                    const auto p = static_cast<float>(visible) / taken;
+                    if (visible == 0 || visible == taken || p * (1 - p) / taken < budget.variance)
+                        break;
+                }
+            }
+            color += lit * (static_cast<float>(visible) / taken);
+            shadow_rays += taken;
+        }
+        return color;
+    }
+
+    // follows one reflection chain until it leaves the scene, reaches a
+    // surface that does not reflect, or runs out of depth
+    template<typename Settings>
+    rgb bounce(const scene& s, path_state p, const Settings& settings, sampler& smp, ray_counts& counts) {
+        const int max_depth = settings.max_depth;
+        const float shadow_spread = settings.shadow_spread;
+        const int shadow_min_samples = settings.shadow_min_samples;
+        const float shadow_variance = settings.shadow_variance;
+        const bool pick_lights = s.lights.size() > static_cast<size_t>(settings.max_exact_lights);
+
+        auto color = rgb{ 0,0,0 };
+        while (true) {
+            material const* closest_material;
+            intersection closest_intersection;
+            std::tie(closest_material, closest_intersection) = s.closest_hit(ray{ p.origin, p.dir });
+            counts.add_path(p.depth);
+            PROFILE_COUNT(reflection_rays, 1);
+
+            if (!closest_material) {
+                color += p.dir.abs() * (p.weight * p.share);
+                break;
+            }
+
+            const auto& mat = *closest_material;
+            const auto norm = closest_intersection.n;
+            const auto pos_of_intersect = p.origin + closest_intersection.d * p.dir;
+            const auto budget = shadow_budget{ p.shadow_samples, shadow_min_samples, shadow_variance, pick_lights };
+            auto shadow_rays = uint64_t{ 0 };
+            color += direct_light(s, pos_of_intersect, norm, p.dir, mat, budget, shadow_spread, smp, shadow_rays) * (p.weight * p.share);
+            counts.add_shadows(p.depth, static_cast<int>(shadow_rays));
+            PROFILE_COUNT(shadow_rays, shadow_rays);
+
+            if (mat.r <= 0 || p.depth + 1 >= max_depth)
+                break;
+            auto throughput = p.weight * mat.r;
+            if (!survives(throughput, settings, smp))
+                break;
+
+            p.origin = pos_of_intersect + (norm * .001f);
+            p.dir = mirror(p.dir, norm);
+            p.weight = throughput;
+            p.depth++;
+            p.shadow_samples = std::max(p.shadow_samples / 2, 1);
+        }
+        return color;
+    }
+
+    // the first surface is handled here because it is the only one that
+    // splits into several reflection rays
+    template<typename Settings>
+    rgb trace(const scene& s, const ray& r, const std::pair<material const*, intersection>& first_hit, const Settings& settings, sampler& smp, ray_counts& counts) {
+        const int max_depth = settings.max_depth;
+        const int reflection_samples = settings.reflection_samples;
+        const int shadow_samples = settings.shadow_samples;
+        const float reflection_spread = settings.reflection_spread;
+        const float shadow_spread = settings.shadow_spread;
+        const auto pick_lights = s.lights.size() > static_cast<size_t>(settings.max_exact_lights);
+        const auto budget = shadow_budget{ shadow_samples, settings.shadow_min_samples, settings.shadow_variance, pick_lights };
+
+        if (max_depth < 1) return{ 0,0,0 };
+        counts.add_path(0);
+        PROFILE_COUNT(primary_rays, 1);
+        if (!first_hit.first) return r.dir.abs();
+
+        const auto& mat = *first_hit.first;
+        const auto norm = first_hit.second.n;
+        const auto pos_of_intersect = r.e + first_hit.second.d * r.dir;
+        auto shadow_rays = uint64_t{ 0 };
+        auto color = direct_light(s, pos_of_intersect, norm, r.dir, mat, budget, shadow_spread, smp, shadow_rays);
+        counts.add_shadows(0, static_cast<int>(shadow_rays));
+        PROFILE_COUNT(shadow_rays, shadow_rays);
+
+        if (mat.r <= 0 || max_depth < 2)
+            return color;
+        // one round for all the reflection samples, they share the throughput;
+        // the split goes in share, so the termination sees the whole path
+        auto throughput = mat.r;
+        if (!survives(throughput, settings, smp))
+            return color;
+
+        const auto reflect_dir = mirror(r.dir, norm);
+        smp.start_set(reflection_samples);
+        for (auto i = 0; i < reflection_samples; i++) {
+            auto u = smp.next();
+            auto wiggle = (reflection_samples > 1) ? sphere_direction(u[0], u[1]) : fvec3{ 0,0,0 };
+            auto p = path_state{ pos_of_intersect + (norm * .001f), (reflect_dir * reflection_spread + wiggle).normalized(), throughput, 1.f / reflection_samples, 1, std::max(shadow_samples / 2, 1) };
+            color += bounce(s, p, settings, smp, counts);
+        }
+        return color;
+    }
+}
+
+rgb lit_by(const light& light, const pos& pos_of_intersect, const fvec3& norm, const fvec3& dir, const material& mat)
+{
+    auto l = (light.pos - pos_of_intersect).normalized();
+    const auto cosine = dot(norm, l);
+    if (cosine <= 0) return rgb{ 0,0,0 };
+    auto v = dir * (-1.f);
+    auto h = (v + l).normalized();
+    auto n = mat.n;
+
+    auto diffuse = mat.diff * light.color * cosine;
+    auto specular = mat.spec * light.color * std::pow(std::max(0.f, dot(norm, h)), n);
+    return diffuse.abs() + specular.abs();
+}
+
+ray_counts& ray_counts::operator+=(const ray_counts& other)
+{
+    for (auto d = 0; d < depths; d++) {
+        paths[d] += other.paths[d];
+        shadows[d] += other.shadows[d];
+    }
+    return *this;
+}
+
+void print_ray_counts(std::ostream& out, const ray_counts& counts)
+{
+    out << "depth  rays  shadow rays" << std::endl;
+    for (auto d = 0; d < ray_counts::depths; d++) {
+        if (counts.paths[d] == 0 && counts.shadows[d] == 0) continue;
+        out << d << (d == ray_counts::depths - 1 ? "+" : "") << "  " << counts.paths[d] << "  " << counts.shadows[d] << std::endl;
+    }
+}
+
+rgb trace_path(const scene& s, const ray& r, const render_settings& settings, sampler& smp, ray_counts& counts)
+{
+    return trace_path(s, r, s.closest_hit(r), settings, smp, counts);
+}
+
+rgb trace_path(const scene& s, const ray& r, const std::pair<material const*, intersection>& first_hit, const render_settings& settings, sampler& smp, ray_counts& counts)
+{
+    PROFILE_COUNT(pixel_samples, 1);
+    if (settings.is_default())
+        return trace(s, r, first_hit, default_settings{}, smp, counts);
+    return trace(s, r, first_hit, settings, smp, counts);
+}
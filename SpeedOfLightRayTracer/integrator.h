@@ -0,0 +1,45 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "scene.h"
+#include "render_settings.h"
+#include "sampler.h"
+#include <utility>
+#include <cstdint>
+#include <ostream>
+
+using genvec::rgb;
+
+// Rays traced per depth, kept per worker and added up after the render.
+// Depths past the last row are counted in it.
+struct ray_counts
+{
+    static const int depths = 16;
+    uint64_t paths[depths] = {};   // closest hit rays, depth 0 are the camera rays
+    uint64_t shadows[depths] = {}; // shadow rays from surfaces at that depth
+
+    void add_path(int depth) { paths[depth < depths ? depth : depths - 1]++; }
+    void add_shadows(int depth, int count) { shadows[depth < depths ? depth : depths - 1] += count; }
+    ray_counts& operator+=(const ray_counts& other);
+};
+
+// one row per depth that saw any rays
+void print_ray_counts(std::ostream& out, const ray_counts& counts);
+
+// Diffuse and specular light from one light if nothing is in the way, for
+// a surface seen along dir. A light behind the surface adds nothing, not
+// even a specular highlight, the same rule light_tree::pick uses, so
+// picking lights and visiting every light agree.
+rgb lit_by(const light& light, const pos& pos_of_intersect, const fvec3& norm, const fvec3& dir, const material& mat);
+
+// Colour seen along a ray. Iterative: the path is followed bounce by bounce
+// with an explicit path state, reading the depth and sample counts from
+// settings. The default settings dispatch to a copy of the loop compiled
+// with them as constants. smp has to be started on the pixel being traced.
+// Paths whose throughput (the product of the reflectances) drops below
+// settings.roulette_weight play Russian roulette, and are cut outright below
+// settings.throughput_cutoff.
+rgb trace_path(const scene& s, const ray& r, const render_settings& settings, sampler& smp, ray_counts& counts);
+
+// the same, for a ray whose first hit is already known (primary packets)
+rgb trace_path(const scene& s, const ray& r, const std::pair<material const*, intersection>& first_hit, const render_settings& settings, sampler& smp, ray_counts& counts);
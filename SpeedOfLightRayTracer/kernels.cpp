@@ -0,0 +1,173 @@
+#include "stdafx.h"
+#include "kernels.h"
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+    // the same root selection as sphere::hit_test, negative on a miss
+    inline float sphere_hit(const sphere_soa& s, uint32_t i, const flat_ray& r) {
+        auto ex = r.ox - s.cx[i];
+        auto ey = r.oy - s.cy[i];
+        auto ez = r.oz - s.cz[i];
+        auto A = r.dx * r.dx + r.dy * r.dy + r.dz * r.dz;
+        auto B = 2 * (r.dx * ex + r.dy * ey + r.dz * ez);
+        auto C = ex * ex + ey * ey + ez * ez - s.rsq[i];
+        auto disc = B*B - 4 * A*C;
+
+        if (disc < 0)
+            return -1.f;
+
+        auto sq = std::sqrt(disc);
+        auto distp = (-B + sq) / (2 * A);
+        auto dists = (-B - sq) / (2 * A);
+
+        if (dists < 0 && distp < 0)
+            return -1.f;
+
+        return (dists > 0) ? dists : distp;
+    }
+
+    // double sided Moller-Trumbore, negative on a miss
+    inline float triangle_hit(const triangle_soa& t, uint32_t i, const flat_ray& r) {
+        const auto e1 = t.e1(i), e2 = t.e2(i);
+        const auto e1x = e1[0], e1y = e1[1], e1z = e1[2];
+        const auto e2x = e2[0], e2y = e2[1], e2z = e2[2];
+
+        // p = d x e2
+        auto px = r.dy * e2z - r.dz * e2y;
+        auto py = r.dz * e2x - r.dx * e2z;
+        auto pz = r.dx * e2y - r.dy * e2x;
+        auto det = e1x * px + e1y * py + e1z * pz;
+        if (det == 0)
+            return -1.f;
+        auto inv = 1 / det;
+
+        auto sx = r.ox - t.ax[i];
+        auto sy = r.oy - t.ay[i];
+        auto sz = r.oz - t.az[i];
+        auto u = (sx * px + sy * py + sz * pz) * inv;
+        if (u < 0 || u > 1)
+            return -1.f;
+
+        // q = s x e1
+        auto qx = sy * e1z - sz * e1y;
+        auto qy = sz * e1x - sx * e1z;
+        auto qz = sx * e1y - sy * e1x;
+        auto v = (r.dx * qx + r.dy * qy + r.dz * qz) * inv;
+        if (v < 0 || u + v > 1)
+            return -1.f;
+
+        auto dist = (e2x * qx + e2y * qy + e2z * qz) * inv;
+        return (dist >= 0) ? dist : -1.f;
+    }
+
+    float sphere_closest(const sphere_soa& s, uint32_t first, uint32_t count, const flat_ray& r, float tmax, uint32_t& hit) {
+        for (auto i = first; i < first + count; i++) {
+            auto dist = sphere_hit(s, i, r);
+            if (dist >= 0 && dist < tmax) {
+                tmax = dist;
+                hit = i;
+            }
+        }
+        return tmax;
+    }
+
+    bool sphere_any(const sphere_soa& s, uint32_t first, uint32_t count, const flat_ray& r, float tmax) {
+        for (auto i = first; i < first + count; i++) {
+            auto dist = sphere_hit(s, i, r);
+            if (dist >= 0 && dist < tmax)
+                return true;
+        }
+        return false;
+    }
+
+    float triangle_closest(const triangle_soa& t, uint32_t first, uint32_t count, const flat_ray& r, float tmax, uint32_t& hit) {
+        for (auto i = first; i < first + count; i++) {
+            auto dist = triangle_hit(t, i, r);
+            if (dist >= 0 && dist < tmax) {
+                tmax = dist;
+                hit = i;
+            }
+        }
+        return tmax;
+    }
+
+    bool triangle_any(const triangle_soa& t, uint32_t first, uint32_t count, const flat_ray& r, float tmax) {
+        for (auto i = first; i < first + count; i++) {
+            auto dist = triangle_hit(t, i, r);
+            if (dist >= 0 && dist < tmax)
+                return true;
+        }
+        return false;
+    }
+
+    void sphere_packet(const sphere_soa& s, uint32_t first, uint32_t count, ray_packet& p) {
+        for (auto i = first; i < first + count; i++) {
+            if (p.bounds.misses_sphere(s.cx[i], s.cy[i], s.cz[i], s.rsq[i]))
+                continue;
+            for (auto lane = 0; lane < ray_packet::size; lane++) {
+                auto dist = sphere_hit(s, i, flat_ray{ p.ox, p.oy, p.oz, p.dx[lane], p.dy[lane], p.dz[lane] });
+                if (dist >= 0 && dist < p.t[lane]) {
+                    p.t[lane] = dist;
+                    p.sphere[lane] = i;
+                }
+            }
+        }
+    }
+
+    void triangle_packet(const triangle_soa& t, uint32_t first, uint32_t count, ray_packet& p) {
+        for (auto i = first; i < first + count; i++) {
+            const auto e1 = t.e1(i), e2 = t.e2(i);
+            if (p.bounds.misses_triangle(t.ax[i], t.ay[i], t.az[i], e1[0], e1[1], e1[2], e2[0], e2[1], e2[2]))
+                continue;
+            for (auto lane = 0; lane < ray_packet::size; lane++) {
+                auto dist = triangle_hit(t, i, flat_ray{ p.ox, p.oy, p.oz, p.dx[lane], p.dy[lane], p.dz[lane] });
+                if (dist >= 0 && dist < p.t[lane]) {
+                    p.t[lane] = dist;
+                    p.triangle[lane] = i;
+                }
+            }
+        }
+    }
+}
+
+bool cpu_has_avx2()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    __cpuid(info, 1);
+    const auto osxsave = (info[2] & (1 << 27)) != 0;
+    const auto avx = (info[2] & (1 << 28)) != 0;
+    const auto fma = (info[2] & (1 << 12)) != 0;
+    const auto f16c = (info[2] & (1 << 29)) != 0; // half edges
+    if (!osxsave || !avx || !fma || !f16c) return false;
+
+    // the OS has to save the ymm registers on context switches
+    if ((_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+#else
+    return false;
+#endif
+}
+
+const intersect_kernels& scalar_kernels()
+{
+    static const intersect_kernels k = { "scalar", 1, sphere_closest, sphere_any, triangle_closest, triangle_any, sphere_packet, triangle_packet };
+    return k;
+}
+
+const intersect_kernels& best_kernels()
+{
+    static const auto& k = cpu_has_avx2() ? avx2_kernels() : scalar_kernels();
+    return k;
+}
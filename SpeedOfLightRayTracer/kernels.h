@@ -0,0 +1,98 @@
+#pragma once
+#include "camera.h"
+#include "flat_array.h"
+#include "packing.h"
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+// index into scene::materials
+using material_index = uint16_t;
+
+// spheres as struct of arrays, in bvh leaf order
+struct sphere_soa
+{
+    flat_array<float> cx, cy, cz;
+    flat_array<float> rsq;
+    flat_array<material_index> mat;
+
+    size_t size() const { return rsq.size(); }
+};
+
+// triangles as struct of arrays, in bvh leaf order. The edges e1 = b - a and
+// e2 = c - a are precomputed for the Moller-Trumbore test, n is the unit
+// normal used for shading, octahedral encoded (see packing.h).
+struct triangle_soa
+{
+    // the half arrays run this far past the last triangle, so 8 wide loads
+    // stay inside them
+    static const size_t half_padding = 8;
+
+    flat_array<float> ax, ay, az;
+    // the edges as floats, or as halves after scene::store_half_edges; the
+    // other set is empty
+    flat_array<float> e1x, e1y, e1z;
+    flat_array<float> e2x, e2y, e2z;
+    flat_array<uint16_t> e1xh, e1yh, e1zh;
+    flat_array<uint16_t> e2xh, e2yh, e2zh;
+    flat_array<uint32_t> n;
+    flat_array<material_index> mat;
+
+    size_t size() const { return mat.size(); }
+    bool half_edges() const { return !e1xh.empty(); }
+
+    fvec3 e1(size_t i) const {
+        if (half_edges()) return fvec3{ half_to_float(e1xh[i]), half_to_float(e1yh[i]), half_to_float(e1zh[i]) };
+        return fvec3{ e1x[i], e1y[i], e1z[i] };
+    }
+    fvec3 e2(size_t i) const {
+        if (half_edges()) return fvec3{ half_to_float(e2xh[i]), half_to_float(e2yh[i]), half_to_float(e2zh[i]) };
+        return fvec3{ e2x[i], e2y[i], e2z[i] };
+    }
+};
+
+struct flat_ray
+{
+    explicit flat_ray(const ray& r)
+        : ox(r.e[0]), oy(r.e[1]), oz(r.e[2])
+        , dx(r.dir[0]), dy(r.dir[1]), dz(r.dir[2]) {}
+
+    flat_ray(float ox, float oy, float oz, float dx, float dy, float dz)
+        : ox(ox), oy(oy), oz(oz)
+        , dx(dx), dy(dy), dz(dz) {}
+
+    float ox, oy, oz;
+    float dx, dy, dz;
+};
+
+const auto no_hit = std::numeric_limits<uint32_t>::max();
+
+// One ray against the primitive range [first, first + count).
+// closest: returns the nearest distance below tmax and sets hit to its index,
+// or returns tmax and leaves hit alone. any: true on any hit below tmax.
+struct intersect_kernels
+{
+    const char* name;
+    int width; // primitives tested per step
+
+    float(*sphere_closest)(const sphere_soa& s, uint32_t first, uint32_t count, const flat_ray& r, float tmax, uint32_t& hit);
+    bool(*sphere_any)(const sphere_soa& s, uint32_t first, uint32_t count, const flat_ray& r, float tmax);
+    float(*triangle_closest)(const triangle_soa& t, uint32_t first, uint32_t count, const flat_ray& r, float tmax, uint32_t& hit);
+    bool(*triangle_any)(const triangle_soa& t, uint32_t first, uint32_t count, const flat_ray& r, float tmax);
+
+    // Every ray of a primary packet against the range: primitives outside the
+    // packet frustum are skipped, the rest update p.t and p.sphere/p.triangle
+    // for the lanes they hit first.
+    void(*sphere_packet)(const sphere_soa& s, uint32_t first, uint32_t count, ray_packet& p);
+    void(*triangle_packet)(const triangle_soa& t, uint32_t first, uint32_t count, ray_packet& p);
+};
+
+bool cpu_has_avx2();
+
+const intersect_kernels& scalar_kernels();
+
+// 8 wide, only valid when cpu_has_avx2() is true
+const intersect_kernels& avx2_kernels();
+
+// the widest kernels this cpu can run
+const intersect_kernels& best_kernels();
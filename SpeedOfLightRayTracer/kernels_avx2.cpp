@@ -0,0 +1,277 @@
+#include "stdafx.h"
+#include "kernels.h"
+
+// 8 wide versions of the kernels in kernels.cpp, picked at runtime by
+// best_kernels(). Release|x64 builds the whole project with /arch:AVX2, so
+// that binary needs an AVX2 cpu anyway and the check only protects the
+// other configurations. gcc and clang compile just these functions for AVX2
+// through the target attribute, and there the check is what keeps the
+// binary running on older cpus.
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+
+#if defined(__GNUC__)
+#define AVX2_FN __attribute__((target("avx2,fma,f16c")))
+#else
+#define AVX2_FN
+#endif
+
+namespace {
+    // lanes [0, n) set
+    AVX2_FN inline __m256i lane_mask(uint32_t n) {
+        const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(n)), lanes);
+    }
+
+    AVX2_FN inline __m256 load(const flat_array<float>& v, uint32_t i, __m256i mask) {
+        return _mm256_maskload_ps(v.data() + i, mask);
+    }
+
+    // halves need no mask, the arrays are padded (see triangle_soa)
+    AVX2_FN inline __m256 load(const flat_array<uint16_t>& v, uint32_t i) {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v.data() + i)));
+    }
+
+    // index of the smallest distance among the hit lanes
+    AVX2_FN inline int closest_lane(__m256 dist, __m256 mask, int hits, float& nearest) {
+        auto d = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), dist, mask);
+        auto m = _mm256_min_ps(d, _mm256_permute2f128_ps(d, d, 1));
+        m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        nearest = _mm256_cvtss_f32(m);
+        auto lanes = _mm256_movemask_ps(_mm256_cmp_ps(d, m, _CMP_EQ_OQ)) & hits;
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, lanes);
+        return static_cast<int>(idx);
+#else
+        return __builtin_ctz(lanes);
+#endif
+    }
+
+    // distance per lane and a mask of lanes that hit closer than tmax
+    AVX2_FN inline __m256 sphere_hit8(const sphere_soa& s, uint32_t i, __m256i valid, const flat_ray& r, __m256 tmax, __m256& hit) {
+        const auto ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+        const auto dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+
+        auto ex = _mm256_sub_ps(ox, load(s.cx, i, valid));
+        auto ey = _mm256_sub_ps(oy, load(s.cy, i, valid));
+        auto ez = _mm256_sub_ps(oz, load(s.cz, i, valid));
+
+        auto A = _mm256_set1_ps(r.dx * r.dx + r.dy * r.dy + r.dz * r.dz);
+        auto B = _mm256_mul_ps(_mm256_set1_ps(2), _mm256_fmadd_ps(dx, ex, _mm256_fmadd_ps(dy, ey, _mm256_mul_ps(dz, ez))));
+        auto C = _mm256_sub_ps(_mm256_fmadd_ps(ex, ex, _mm256_fmadd_ps(ey, ey, _mm256_mul_ps(ez, ez))), load(s.rsq, i, valid));
+        auto disc = _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_set1_ps(4), A), C, _mm256_mul_ps(B, B));
+
+        auto sq = _mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps()));
+        auto inv2a = _mm256_div_ps(_mm256_set1_ps(1), _mm256_add_ps(A, A));
+        auto negb = _mm256_sub_ps(_mm256_setzero_ps(), B);
+        auto distp = _mm256_mul_ps(_mm256_add_ps(negb, sq), inv2a);
+        auto dists = _mm256_mul_ps(_mm256_sub_ps(negb, sq), inv2a);
+        auto dist = _mm256_blendv_ps(distp, dists, _mm256_cmp_ps(dists, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+        hit = _mm256_and_ps(_mm256_castsi256_ps(valid), _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tmax, _CMP_LT_OQ));
+        return dist;
+    }
+
+    AVX2_FN inline __m256 triangle_hit8(const triangle_soa& t, uint32_t i, __m256i valid, const flat_ray& r, __m256 tmax, __m256& hit) {
+        const auto dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+        const auto zero = _mm256_setzero_ps();
+        const auto one = _mm256_set1_ps(1);
+
+        __m256 e1x, e1y, e1z, e2x, e2y, e2z;
+        if (t.half_edges()) {
+            e1x = load(t.e1xh, i); e1y = load(t.e1yh, i); e1z = load(t.e1zh, i);
+            e2x = load(t.e2xh, i); e2y = load(t.e2yh, i); e2z = load(t.e2zh, i);
+        }
+        else {
+            e1x = load(t.e1x, i, valid); e1y = load(t.e1y, i, valid); e1z = load(t.e1z, i, valid);
+            e2x = load(t.e2x, i, valid); e2y = load(t.e2y, i, valid); e2z = load(t.e2z, i, valid);
+        }
+
+        // p = d x e2
+        auto px = _mm256_fmsub_ps(dy, e2z, _mm256_mul_ps(dz, e2y));
+        auto py = _mm256_fmsub_ps(dz, e2x, _mm256_mul_ps(dx, e2z));
+        auto pz = _mm256_fmsub_ps(dx, e2y, _mm256_mul_ps(dy, e2x));
+        auto det = _mm256_fmadd_ps(e1x, px, _mm256_fmadd_ps(e1y, py, _mm256_mul_ps(e1z, pz)));
+        auto inv = _mm256_div_ps(one, det);
+
+        auto sx = _mm256_sub_ps(_mm256_set1_ps(r.ox), load(t.ax, i, valid));
+        auto sy = _mm256_sub_ps(_mm256_set1_ps(r.oy), load(t.ay, i, valid));
+        auto sz = _mm256_sub_ps(_mm256_set1_ps(r.oz), load(t.az, i, valid));
+        auto u = _mm256_mul_ps(_mm256_fmadd_ps(sx, px, _mm256_fmadd_ps(sy, py, _mm256_mul_ps(sz, pz))), inv);
+
+        // q = s x e1
+        auto qx = _mm256_fmsub_ps(sy, e1z, _mm256_mul_ps(sz, e1y));
+        auto qy = _mm256_fmsub_ps(sz, e1x, _mm256_mul_ps(sx, e1z));
+        auto qz = _mm256_fmsub_ps(sx, e1y, _mm256_mul_ps(sy, e1x));
+        auto v = _mm256_mul_ps(_mm256_fmadd_ps(dx, qx, _mm256_fmadd_ps(dy, qy, _mm256_mul_ps(dz, qz))), inv);
+        auto dist = _mm256_mul_ps(_mm256_fmadd_ps(e2x, qx, _mm256_fmadd_ps(e2y, qy, _mm256_mul_ps(e2z, qz))), inv);
+
+        hit = _mm256_and_ps(_mm256_castsi256_ps(valid), _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tmax, _CMP_LT_OQ));
+        return dist;
+    }
+
+    template<typename Prims, typename Hit8>
+    AVX2_FN inline float closest8(const Prims& p, uint32_t first, uint32_t count, const flat_ray& r, float tmax, uint32_t& hit, Hit8 hit8) {
+        for (auto i = first; i < first + count; i += 8) {
+            auto valid = lane_mask(first + count - i);
+            __m256 mask;
+            auto dist = hit8(p, i, valid, r, _mm256_set1_ps(tmax), mask);
+            auto hits = _mm256_movemask_ps(mask);
+            if (hits) {
+                auto lane = closest_lane(dist, mask, hits, tmax);
+                hit = i + lane;
+            }
+        }
+        return tmax;
+    }
+
+    template<typename Prims, typename Hit8>
+    AVX2_FN inline bool any8(const Prims& p, uint32_t first, uint32_t count, const flat_ray& r, float tmax, Hit8 hit8) {
+        for (auto i = first; i < first + count; i += 8) {
+            auto valid = lane_mask(first + count - i);
+            __m256 mask;
+            hit8(p, i, valid, r, _mm256_set1_ps(tmax), mask);
+            if (_mm256_movemask_ps(mask))
+                return true;
+        }
+        return false;
+    }
+
+    // Packet versions: the rays share their origin, so everything that only
+    // depends on the origin and the primitive is worked out once per primitive
+    // and the lanes run over rays instead of primitives.
+    AVX2_FN void sphere_packet(const sphere_soa& s, uint32_t first, uint32_t count, ray_packet& p) {
+        const auto zero = _mm256_setzero_ps();
+        for (auto i = first; i < first + count; i++) {
+            if (p.bounds.misses_sphere(s.cx[i], s.cy[i], s.cz[i], s.rsq[i]))
+                continue;
+
+            const auto exs = p.ox - s.cx[i], eys = p.oy - s.cy[i], ezs = p.oz - s.cz[i];
+            const auto ex = _mm256_set1_ps(exs), ey = _mm256_set1_ps(eys), ez = _mm256_set1_ps(ezs);
+            const auto C = _mm256_set1_ps(exs * exs + eys * eys + ezs * ezs - s.rsq[i]);
+            const auto index = _mm256_set1_epi32(static_cast<int>(i));
+
+            for (auto lane = 0; lane < ray_packet::size; lane += 8) {
+                auto dx = _mm256_load_ps(p.dx + lane), dy = _mm256_load_ps(p.dy + lane), dz = _mm256_load_ps(p.dz + lane);
+                auto tmax = _mm256_load_ps(p.t + lane);
+
+                auto A = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+                auto B = _mm256_mul_ps(_mm256_set1_ps(2), _mm256_fmadd_ps(dx, ex, _mm256_fmadd_ps(dy, ey, _mm256_mul_ps(dz, ez))));
+                auto disc = _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_set1_ps(4), A), C, _mm256_mul_ps(B, B));
+
+                auto sq = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+                auto inv2a = _mm256_div_ps(_mm256_set1_ps(1), _mm256_add_ps(A, A));
+                auto negb = _mm256_sub_ps(zero, B);
+                auto distp = _mm256_mul_ps(_mm256_add_ps(negb, sq), inv2a);
+                auto dists = _mm256_mul_ps(_mm256_sub_ps(negb, sq), inv2a);
+                auto dist = _mm256_blendv_ps(distp, dists, _mm256_cmp_ps(dists, zero, _CMP_GT_OQ));
+
+                auto hit = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tmax, _CMP_LT_OQ));
+                if (!_mm256_movemask_ps(hit))
+                    continue;
+
+                _mm256_store_ps(p.t + lane, _mm256_blendv_ps(tmax, dist, hit));
+                auto old = _mm256_load_si256(reinterpret_cast<const __m256i*>(p.sphere + lane));
+                auto merged = _mm256_blendv_epi8(old, index, _mm256_castps_si256(hit));
+                _mm256_store_si256(reinterpret_cast<__m256i*>(p.sphere + lane), merged);
+            }
+        }
+    }
+
+    AVX2_FN void triangle_packet(const triangle_soa& t, uint32_t first, uint32_t count, ray_packet& p) {
+        const auto zero = _mm256_setzero_ps();
+        const auto one = _mm256_set1_ps(1);
+        for (auto i = first; i < first + count; i++) {
+            const auto e1 = t.e1(i), e2 = t.e2(i);
+            const auto e1x = e1[0], e1y = e1[1], e1z = e1[2];
+            const auto e2x = e2[0], e2y = e2[1], e2z = e2[2];
+            if (p.bounds.misses_triangle(t.ax[i], t.ay[i], t.az[i], e1x, e1y, e1z, e2x, e2y, e2z))
+                continue;
+            const auto sx = p.ox - t.ax[i], sy = p.oy - t.ay[i], sz = p.oz - t.az[i];
+            // q = s x e1 and the distance numerator do not depend on the direction
+            const auto qx = sy * e1z - sz * e1y;
+            const auto qy = sz * e1x - sx * e1z;
+            const auto qz = sx * e1y - sy * e1x;
+            const auto dist_num = _mm256_set1_ps(e2x * qx + e2y * qy + e2z * qz);
+            const auto index = _mm256_set1_epi32(static_cast<int>(i));
+
+            const auto E1x = _mm256_set1_ps(e1x), E1y = _mm256_set1_ps(e1y), E1z = _mm256_set1_ps(e1z);
+            const auto E2x = _mm256_set1_ps(e2x), E2y = _mm256_set1_ps(e2y), E2z = _mm256_set1_ps(e2z);
+            const auto Sx = _mm256_set1_ps(sx), Sy = _mm256_set1_ps(sy), Sz = _mm256_set1_ps(sz);
+            const auto Qx = _mm256_set1_ps(qx), Qy = _mm256_set1_ps(qy), Qz = _mm256_set1_ps(qz);
+
+            for (auto lane = 0; lane < ray_packet::size; lane += 8) {
+                auto dx = _mm256_load_ps(p.dx + lane), dy = _mm256_load_ps(p.dy + lane), dz = _mm256_load_ps(p.dz + lane);
+                auto tmax = _mm256_load_ps(p.t + lane);
+
+                // p = d x e2
+                auto px = _mm256_fmsub_ps(dy, E2z, _mm256_mul_ps(dz, E2y));
+                auto py = _mm256_fmsub_ps(dz, E2x, _mm256_mul_ps(dx, E2z));
+                auto pz = _mm256_fmsub_ps(dx, E2y, _mm256_mul_ps(dy, E2x));
+                auto det = _mm256_fmadd_ps(E1x, px, _mm256_fmadd_ps(E1y, py, _mm256_mul_ps(E1z, pz)));
+                auto inv = _mm256_div_ps(one, det);
+
+                auto u = _mm256_mul_ps(_mm256_fmadd_ps(Sx, px, _mm256_fmadd_ps(Sy, py, _mm256_mul_ps(Sz, pz))), inv);
+                auto v = _mm256_mul_ps(_mm256_fmadd_ps(dx, Qx, _mm256_fmadd_ps(dy, Qy, _mm256_mul_ps(dz, Qz))), inv);
+                auto dist = _mm256_mul_ps(dist_num, inv);
+
+                auto hit = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(dist, tmax, _CMP_LT_OQ));
+                if (!_mm256_movemask_ps(hit))
+                    continue;
+
+                _mm256_store_ps(p.t + lane, _mm256_blendv_ps(tmax, dist, hit));
+                auto old = _mm256_load_si256(reinterpret_cast<const __m256i*>(p.triangle + lane));
+                auto merged = _mm256_blendv_epi8(old, index, _mm256_castps_si256(hit));
+                _mm256_store_si256(reinterpret_cast<__m256i*>(p.triangle + lane), merged);
+            }
+        }
+    }
+
+    AVX2_FN float sphere_closest(const sphere_soa& s, uint32_t first, uint32_t count, const flat_ray& r, float tmax, uint32_t& hit) {
+        return closest8(s, first, count, r, tmax, hit, sphere_hit8);
+    }
+
+    AVX2_FN bool sphere_any(const sphere_soa& s, uint32_t first, uint32_t count, const flat_ray& r, float tmax) {
+        return any8(s, first, count, r, tmax, sphere_hit8);
+    }
+
+    AVX2_FN float triangle_closest(const triangle_soa& t, uint32_t first, uint32_t count, const flat_ray& r, float tmax, uint32_t& hit) {
+        return closest8(t, first, count, r, tmax, hit, triangle_hit8);
+    }
+
+    AVX2_FN bool triangle_any(const triangle_soa& t, uint32_t first, uint32_t count, const flat_ray& r, float tmax) {
+        return any8(t, first, count, r, tmax, triangle_hit8);
+    }
+}
+
+const intersect_kernels& avx2_kernels()
+{
+    static const intersect_kernels k = { "avx2", 8, sphere_closest, sphere_any, triangle_closest, triangle_any, sphere_packet, triangle_packet };
+    return k;
+}
+
+#else
+
+const intersect_kernels& avx2_kernels()
+{
+    return scalar_kernels();
+}
+
+#endif
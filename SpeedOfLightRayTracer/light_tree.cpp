@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "light_tree.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+using genvec::dot;
+
+namespace {
+    float power(const light& l) {
+        auto c = l.color.abs();
+        return c[0] + c[1] + c[2];
+    }
+}
+
+light_tree::light_tree(const std::vector<light>& lights)
+{
+    if (lights.empty()) return;
+
+    for (const auto& l : lights) {
+        total_color += l.color.abs();
+    }
+
+    auto ids = std::vector<uint32_t>(lights.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    nodes.reserve(2 * lights.size());
+    build(lights, ids, 0, static_cast<uint32_t>(ids.size()));
+}
+
+uint32_t light_tree::build(const std::vector<light>& lights, std::vector<uint32_t>& ids, uint32_t begin, uint32_t end)
+{
+    const auto index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(node{});
+
+    auto box = aabb{};
+    auto total = 0.f;
+    for (auto i = begin; i < end; i++) {
+        box.grow(lights[ids[i]].pos);
+        total += power(lights[ids[i]]);
+    }
+
+    if (end - begin == 1) {
+        nodes[index] = node{ box, total, ids[begin], true };
+        return index;
+    }
+
+    // median split along the longest axis keeps the tree balanced
+    const auto axis = box.longest_axis();
+    const auto mid = begin + (end - begin) / 2;
+    std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end, [&](uint32_t a, uint32_t b) {
+        return lights[a].pos[axis] < lights[b].pos[axis];
+    });
+
+    build(lights, ids, begin, mid);
+    const auto second = build(lights, ids, mid, end);
+    nodes[index] = node{ box, total, second, false };
+    return index;
+}
+
+float light_tree::importance(const node& n, const pos& p, const fvec3& normal) const
+{
+    // largest cosine between the normal and a direction into the box: the
+    // box seen from p fits in a cone around the direction to its centre
+    const auto to_center = n.box.centroid() - p;
+    const auto dist = to_center.len();
+    const auto radius = (n.box.extent() * .5f).len();
+    if (dist <= radius)
+        return n.power;
+
+    // cos(center angle - cone half angle), without the trigonometry
+    const auto cos_center = std::max(-1.f, std::min(1.f, dot(normal, to_center) / dist));
+    const auto sin_cone = radius / dist;
+    const auto cos_cone = std::sqrt(1 - sin_cone * sin_cone);
+    if (cos_center >= cos_cone)
+        return n.power;
+    const auto sin_center = std::sqrt(1 - cos_center * cos_center);
+    return n.power * std::max(0.f, cos_center * cos_cone + sin_center * sin_cone);
+}
+
+bool light_tree::pick(const pos& p, const fvec3& n, float& u, uint32_t& index, float& pdf) const
+{
+    if (nodes.empty()) return false;
+
+    pdf = 1;
+    uint32_t ni = 0;
+    while (!nodes[ni].leaf) {
+        const auto first = ni + 1;
+        const auto second = nodes[ni].offset;
+        const auto w0 = importance(nodes[first], p, n);
+        const auto w1 = importance(nodes[second], p, n);
+        if (w0 + w1 <= 0) return false;
+
+        // reuse u: the part left after the choice is uniform again
+        const auto p0 = w0 / (w0 + w1);
+        if (u < p0) {
+            u = u / p0;
+            pdf *= p0;
+            ni = first;
+        }
+        else {
+            u = (u - p0) / (1 - p0);
+            pdf *= 1 - p0;
+            ni = second;
+        }
+        u = std::min(u, 0.99999994f);
+    }
+
+    // a lone light behind the surface is never reached through a parent
+    if (importance(nodes[ni], p, n) <= 0) return false;
+    index = nodes[ni].offset;
+    return true;
+}
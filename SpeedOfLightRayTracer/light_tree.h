@@ -0,0 +1,47 @@
+#pragma once
+#include "genvec.h"
+#include "light.h"
+#include "aabb.h"
+#include <vector>
+#include <cstdint>
+
+using genvec::pos;
+using genvec::fvec3;
+using genvec::rgb;
+
+// Binary tree over the point lights for picking one light per shadow ray.
+// Every node keeps the bounds and the total power (sum of |colour|) of the
+// lights below it. A pick walks down from the root and at each node takes a
+// child in proportion to its power times the largest cosine any of its
+// lights can make with the surface normal, so lights behind the surface
+// are never picked and groups of lights are weighed by what they can add
+// at the shading point. The lights themselves are not reordered.
+class light_tree
+{
+public:
+    light_tree() {}
+    explicit light_tree(const std::vector<light>& lights);
+
+    // Picks a light for a surface at p with normal n. u in [0, 1) chooses,
+    // and on return is a fresh uniform number in [0, 1) left over from the
+    // choice. False when no light is in front of the surface.
+    bool pick(const pos& p, const fvec3& n, float& u, uint32_t& index, float& pdf) const;
+
+    bool empty() const { return nodes.empty(); }
+
+    // sum of |colour| over every light, for the ambient term
+    rgb total_color = rgb{ 0,0,0 };
+
+private:
+    struct node {
+        aabb box;
+        float power;
+        uint32_t offset; // leaf: light index, interior: index of the second child
+        bool leaf;
+    };
+
+    float importance(const node& n, const pos& p, const fvec3& normal) const;
+    uint32_t build(const std::vector<light>& lights, std::vector<uint32_t>& ids, uint32_t begin, uint32_t end);
+
+    std::vector<node> nodes;
+};
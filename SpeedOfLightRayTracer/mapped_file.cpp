@@ -0,0 +1,92 @@
+#include "stdafx.h"
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+#if defined(_WIN32)
+bool mapped_file::open(const char* path)
+{
+    close();
+    auto f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    // delete sharing lets replace_file put a new file in its place
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(f, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(f);
+        return false;
+    }
+    auto m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    auto view = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (m) CloseHandle(m);
+        CloseHandle(f);
+        return false;
+    }
+    file = f;
+    mapping = m;
+    bytes = static_cast<const unsigned char*>(view);
+    length = static_cast<size_t>(file_size.QuadPart);
+    return true;
+}
+
+void mapped_file::close()
+{
+    if (bytes) UnmapViewOfFile(bytes);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    bytes = nullptr;
+    mapping = file = nullptr;
+    length = 0;
+}
+
+bool replace_file(const char* from, const char* to)
+{
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+bool mapped_file::open(const char* path)
+{
+    close();
+    const auto fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    auto view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+    bytes = static_cast<const unsigned char*>(view);
+    length = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void mapped_file::close()
+{
+    if (bytes) munmap(const_cast<unsigned char*>(bytes), length);
+    bytes = nullptr;
+    length = 0;
+}
+
+bool replace_file(const char* from, const char* to)
+{
+    // rename swaps the directory entry; the old inode lives on while mapped
+    return rename(from, to) == 0;
+}
+#endif
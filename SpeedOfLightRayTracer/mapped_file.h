@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+
+// A whole file mapped read only into memory; the pages are loaded by the
+// OS when they are first touched and shared with other processes that map
+// the same file. Unmapped when destroyed.
+class mapped_file
+{
+public:
+    mapped_file() {}
+    ~mapped_file();
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // false when the file cannot be opened or is empty
+    bool open(const char* path);
+    void close();
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#if defined(_WIN32)
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// Moves the file from over the file to in one step, replacing it. Anyone
+// who has the old file mapped keeps its pages, so a cache can be refreshed
+// while other processes render from it.
+bool replace_file(const char* from, const char* to);
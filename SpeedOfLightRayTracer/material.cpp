@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "material.h"
+#include <functional>
 
 
 material::material()
@@ -16,3 +17,21 @@ material::material(float alpha, genvec::rgb ambient, genvec::rgb diff, genvec::r
 material::~material()
 {
 }
+
+bool material::operator==(const material& other) const
+{
+	return alpha == other.alpha && ambient == other.ambient && diff == other.diff
+		&& spec == other.spec && n == other.n && r == other.r;
+}
+
+size_t material_hash::operator()(const material& m) const
+{
+	const float fields[] = { m.alpha, m.ambient[0], m.ambient[1], m.ambient[2], m.diff[0], m.diff[1], m.diff[2],
+		m.spec[0], m.spec[1], m.spec[2], m.n, m.r };
+	auto h = size_t{ 0 };
+	for (auto v : fields) {
+		// adding 0 turns -0 into 0, the two compare equal
+		h ^= std::hash<float>()(v + 0.f) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	}
+	return h;
+}
@@ -8,6 +8,8 @@ public:
 	material();
 	~material();
 
+	bool operator==(const material& other) const;
+
 	const float alpha; // 0 = transparent, 1 = opaque
 	const genvec::rgb ambient;
 	const genvec::rgb diff;
@@ -16,6 +18,12 @@ public:
     const float r;
 };
 
+// for hash tables of materials, equal ones by operator== hash alike
+struct material_hash
+{
+	size_t operator()(const material& m) const;
+};
+
 namespace materials {
     const auto red =   material{ 1, { .1,0,0 },{ 1,0,0 },{ .1,.1,.1 }, 20, 0.7f };
     const auto green = material{ 1, { .1,0,0 },{ 0,1,0 },{ .1,.1,.1 }, 20, 0.7f };
@@ -0,0 +1,282 @@
+#include "stdafx.h"
+#include "mesh.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <thread>
+
+using genvec::dot;
+using genvec::cross;
+
+namespace {
+    // what one chunk of the file holds, from the counting pass
+    struct chunk {
+        const char* begin;
+        const char* end;
+        size_t vertices = 0;
+        size_t triangles = 0;
+        size_t bad_faces = 0;
+    };
+
+    bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char* skip_space(const char* p, const char* end) {
+        while (p < end && is_space(*p)) p++;
+        return p;
+    }
+
+    const char* line_end(const char* p, const char* end) {
+        while (p < end && *p != '\n') p++;
+        return p;
+    }
+
+    double power_of_ten(int e) {
+        static const double exact[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        if (e >= 0 && e <= 22) return exact[e];
+        if (e < 0 && e >= -22) return 1 / exact[-e];
+        return std::pow(10., e);
+    }
+
+    // decimal float with an optional sign, fraction and exponent; strtof
+    // is locale dependent and needs a terminated string
+    const char* parse_float(const char* p, const char* end, float& out) {
+        auto negative = false;
+        if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+        auto mantissa = 0.;
+        while (p < end && *p >= '0' && *p <= '9') mantissa = mantissa * 10 + (*p++ - '0');
+        auto exponent = 0;
+        if (p < end && *p == '.') {
+            p++;
+            while (p < end && *p >= '0' && *p <= '9') {
+                mantissa = mantissa * 10 + (*p++ - '0');
+                exponent--;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            p++;
+            auto negative_exponent = false;
+            if (p < end && (*p == '-' || *p == '+')) negative_exponent = *p++ == '-';
+            auto e = 0;
+            while (p < end && *p >= '0' && *p <= '9') e = e * 10 + (*p++ - '0');
+            exponent += negative_exponent ? -e : e;
+        }
+        out = static_cast<float>((negative ? -mantissa : mantissa) * power_of_ten(exponent));
+        return p;
+    }
+
+    // one corner of a face: the vertex index, then /texture/normal which are skipped
+    const char* parse_corner(const char* p, const char* end, long long& index) {
+        auto negative = false;
+        if (p < end && *p == '-') { negative = true; p++; }
+        index = 0;
+        while (p < end && *p >= '0' && *p <= '9') index = index * 10 + (*p++ - '0');
+        if (negative) index = -index;
+        while (p < end && !is_space(*p) && *p != '\n') p++;
+        return p;
+    }
+
+    // corners of a face line that starts at p, just after the "f"
+    int count_corners(const char* p, const char* end) {
+        auto corners = 0;
+        while (true) {
+            p = skip_space(p, end);
+            if (p >= end || *p == '\n') return corners;
+            corners++;
+            while (p < end && !is_space(*p) && *p != '\n') p++;
+        }
+    }
+
+    bool starts(const char* p, const char* end, char c) {
+        return p + 1 < end && p[0] == c && is_space(p[1]);
+    }
+
+    void count_chunk(chunk& c) {
+        for (auto p = c.begin; p < c.end; p = line_end(p, c.end) + 1) {
+            p = skip_space(p, c.end);
+            if (starts(p, c.end, 'v')) {
+                c.vertices++;
+            }
+            else if (starts(p, c.end, 'f')) {
+                const auto corners = count_corners(p + 1, c.end);
+                if (corners >= 3) c.triangles += corners - 2;
+            }
+        }
+    }
+
+    // fills the chunk's vertices and triangles from first_vertex and
+    // first_triangle on; vertex_base is the mesh's vertex count before the file
+    void parse_chunk(chunk& c, size_t vertex_base, size_t first_vertex, size_t first_triangle, size_t vertex_total, mesh& m) {
+        auto v = first_vertex;
+        auto t = first_triangle;
+        for (auto p = c.begin; p < c.end; p = line_end(p, c.end) + 1) {
+            p = skip_space(p, c.end);
+            if (starts(p, c.end, 'v')) {
+                p++;
+                for (auto k = 0; k < 3; k++) {
+                    p = parse_float(skip_space(p, c.end), c.end, m.positions[(vertex_base + v) * 3 + k]);
+                }
+                v++;
+            }
+            else if (starts(p, c.end, 'f')) {
+                const auto corners = count_corners(p + 1, c.end);
+                if (corners < 3) continue;
+                p++;
+                // negative indices are relative to the vertices read so far
+                uint32_t first = 0, previous = 0;
+                auto bad = false;
+                for (auto k = 0; k < corners; k++) {
+                    long long index;
+                    p = parse_corner(skip_space(p, c.end), c.end, index);
+                    const auto absolute = index > 0 ? index - 1 : static_cast<long long>(v) + index;
+                    bad |= index == 0 || absolute < 0 || absolute >= static_cast<long long>(vertex_total);
+                    const auto corner = static_cast<uint32_t>(vertex_base + (bad ? 0 : absolute));
+                    if (k == 0) first = corner;
+                    if (k >= 2) {
+                        auto* tri = &m.indices[t++ * 3];
+                        tri[0] = first; tri[1] = previous; tri[2] = corner;
+                    }
+                    previous = corner;
+                }
+                if (bad) {
+                    // degenerate, flatten drops it
+                    for (auto k = t - (corners - 2); k < t; k++) {
+                        m.indices[k * 3] = m.indices[k * 3 + 1] = m.indices[k * 3 + 2] = static_cast<uint32_t>(vertex_base);
+                    }
+                    c.bad_faces++;
+                }
+            }
+        }
+    }
+}
+
+void mesh::fit(const aabb& box)
+{
+    const auto from = bounds();
+    if (from.empty()) return;
+    const auto size = from.extent();
+    const auto target = box.extent();
+    const auto largest = std::max(size[0], std::max(size[1], size[2]));
+    if (largest <= 0) return;
+    const auto scale = std::min(target[0], std::min(target[1], target[2])) / largest;
+    const auto shift = box.centroid() - from.centroid() * scale;
+    for (size_t i = 0; i < positions.size(); i++) {
+        positions[i] = positions[i] * scale + shift[i % 3];
+    }
+}
+
+intersection mesh::intersect(const ray& r) const
+{
+    auto best = intersection{};
+    for (size_t t = 0; t < triangle_count(); t++) {
+        const auto hit = triangle(vertex(indices[t * 3]), vertex(indices[t * 3 + 1]), vertex(indices[t * 3 + 2]), mat).intersect(r);
+        if (hit.valid && (!best.valid || hit.d < best.d))
+            best = hit;
+    }
+    return best;
+}
+
+bool mesh::occludes(const ray& r, float tmax) const
+{
+    for (size_t t = 0; t < triangle_count(); t++) {
+        if (triangle(vertex(indices[t * 3]), vertex(indices[t * 3 + 1]), vertex(indices[t * 3 + 2]), mat).occludes(r, tmax))
+            return true;
+    }
+    return false;
+}
+
+aabb mesh::bounds() const
+{
+    auto box = aabb{};
+    for (uint32_t i = 0; i < vertex_count(); i++) {
+        box.grow(vertex(i));
+    }
+    return box;
+}
+
+void mesh::flatten(scene& s) const
+{
+    s.add_mesh(positions, indices, s.add_material(mat));
+}
+
+bool load_obj(const char* path, mesh& m, obj_stats& stats)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto file = std::ifstream(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cout << "could not open " << path << std::endl;
+        return false;
+    }
+    const auto bytes = static_cast<size_t>(file.tellg());
+    auto text = std::vector<char>(bytes);
+    file.seekg(0);
+    if (bytes > 0 && !file.read(text.data(), bytes)) {
+        std::cout << "could not read " << path << std::endl;
+        return false;
+    }
+
+    // a few chunks a thread so that dense and sparse parts even out
+    const char* end = text.data() + bytes;
+    const auto threads = std::max(1u, std::thread::hardware_concurrency());
+    const auto wanted = std::min<size_t>(threads * 4, bytes / 4096 + 1);
+    auto chunks = std::vector<chunk>();
+    for (const char* p = text.data(); p < end;) {
+        auto c = chunk{};
+        c.begin = p;
+        c.end = std::min(end, p + bytes / wanted + 1);
+        // every chunk ends just after a line end
+        if (c.end < end) c.end = std::min(end, line_end(c.end, end) + 1);
+        chunks.push_back(c);
+        p = c.end;
+    }
+    const auto n = static_cast<int>(chunks.size());
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (auto i = 0; i < n; i++) {
+        count_chunk(chunks[i]);
+    }
+
+    auto first_vertex = std::vector<size_t>(n + 1, 0);
+    auto first_triangle = std::vector<size_t>(n + 1, 0);
+    for (auto i = 0; i < n; i++) {
+        first_vertex[i + 1] = first_vertex[i] + chunks[i].vertices;
+        first_triangle[i + 1] = first_triangle[i] + chunks[i].triangles;
+    }
+    const auto vertex_base = m.vertex_count();
+    const auto triangle_base = m.triangle_count();
+    m.positions.resize((vertex_base + first_vertex[n]) * 3);
+    m.indices.resize((triangle_base + first_triangle[n]) * 3);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (auto i = 0; i < n; i++) {
+        parse_chunk(chunks[i], vertex_base, first_vertex[i], triangle_base + first_triangle[i], first_vertex[n], m);
+    }
+
+    stats.file_bytes = bytes;
+    stats.vertices = first_vertex[n];
+    stats.triangles = first_triangle[n];
+    stats.bad_faces = 0;
+    for (const auto& c : chunks) {
+        stats.bad_faces += c.bad_faces;
+    }
+    stats.chunks = n;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+void print_obj_stats(std::ostream& out, const obj_stats& stats, const mesh& m)
+{
+    const auto seconds = std::max(stats.seconds, 1e-9);
+    out << "obj: " << stats.vertices << " vertices, " << stats.triangles << " triangles in " << stats.seconds << " s ("
+        << stats.chunks << " chunks), " << stats.triangles / seconds / 1e6 << " M triangles/s, "
+        << stats.file_bytes / seconds / 1e6 << " MB/s" << std::endl;
+    if (stats.bad_faces > 0)
+        out << "obj: dropped " << stats.bad_faces << " faces with indices outside the vertex list" << std::endl;
+    if (m.triangle_count() > 0) {
+        const auto bytes = m.positions.size() * sizeof(float) + m.indices.size() * sizeof(uint32_t);
+        out << "obj: " << static_cast<double>(bytes) / m.triangle_count() << " bytes per triangle in the mesh" << std::endl;
+    }
+}
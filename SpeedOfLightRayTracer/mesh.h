@@ -0,0 +1,54 @@
+#pragma once
+#include "objects.h"
+#include <vector>
+#include <iosfwd>
+#include <cstdint>
+
+// An indexed triangle mesh: one shared vertex buffer of packed xyz floats
+// (12 bytes a vertex, where a pos takes 16) and three indices a triangle.
+// The per-ray data, edges and normals, is only worked out when the mesh
+// is flattened into the scene's triangle arrays.
+class mesh : public object {
+public:
+    mesh(material mat) : object(mat) {}
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+    pos vertex(uint32_t i) const { return pos{ positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2] }; }
+
+    // scales and moves the mesh uniformly so its bounds fit inside box, centred
+    void fit(const aabb& box);
+
+    // one triangle at a time, for the object interface only; scene uses the
+    // flattened triangles
+    virtual intersection intersect(const ray& r) const override;
+    virtual bool occludes(const ray& r, float tmax) const override;
+    virtual aabb bounds() const override;
+    virtual void flatten(scene& s) const override;
+
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+};
+
+struct obj_stats
+{
+    size_t file_bytes = 0;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    size_t bad_faces = 0; // faces with an index outside the vertex list, dropped
+    int chunks = 0;       // pieces of the file parsed in parallel
+    double seconds = 0;
+};
+
+// Reads the vertices and faces of a Wavefront OBJ file into m, appending
+// to what is there. Faces with more than three corners become fans,
+// negative indices count back from the last vertex, and texture and
+// normal indices, groups and materials are skipped. The file is read in
+// one go and cut at line ends into chunks that are parsed in parallel:
+// one pass counts the vertices and triangles of every chunk, so the
+// second can write each chunk's share straight into place. False, with a
+// message, when the file cannot be read.
+bool load_obj(const char* path, mesh& m, obj_stats& stats);
+
+// triangles and megabytes a second, and the bytes a triangle takes in the mesh
+void print_obj_stats(std::ostream& out, const obj_stats& stats, const mesh& m);
@@ -1,9 +1,24 @@
 #pragma once
 #include <memory>
+#include <vector>
+#include "camera.h"
+#include "material.h"
+#include "intersection.h"
+#include "aabb.h"
+#include "scene.h"
+
 class object {
 public:
     object(material mat) :mat(mat) {}
     virtual intersection intersect(const ray& ray) const = 0;
+
+    // visibility only: true if the ray hits this object closer than tmax
+    virtual bool occludes(const ray& ray, float tmax) const = 0;
+    virtual aabb bounds() const = 0;
+
+    // adds the primitives this object is made of to the flat scene
+    virtual void flatten(scene& s) const = 0;
+
     const material mat;
 };
 
@@ -40,6 +55,22 @@ public:
             return{ dist, n };
     }
 
+    virtual bool occludes(const ray& r, float tmax) const override {
+        auto dist = hit_test(r);
+        return dist >= 0 && dist < tmax;
+    }
+
+    virtual aabb bounds() const override {
+        auto box = aabb{};
+        box.grow(a);
+        box.grow(b);
+        box.grow(c);
+        return box;
+    }
+
+    virtual void flatten(scene& s) const override {
+        s.add_triangle(a, b, c, n, s.add_material(mat));
+    }
 };
 
 class plane : public object {
@@ -61,6 +92,20 @@ public:
         return b.intersect(r);
     }
 
+    virtual bool occludes(const ray& r, float tmax) const override {
+        return a.occludes(r, tmax) || b.occludes(r, tmax);
+    }
+
+    virtual aabb bounds() const override {
+        auto box = a.bounds();
+        box.grow(b.bounds());
+        return box;
+    }
+
+    virtual void flatten(scene& s) const override {
+        a.flatten(s);
+        b.flatten(s);
+    }
 };
 
 class sphere : public object {
@@ -73,7 +118,7 @@ public:
         , c(center)
         , rsq(radius*radius) {}
 
-    virtual intersection intersect(const ray& r) const override {
+    float hit_test(const ray& r) const {
         const auto& d = r.dir;
         const auto& e = r.e;
         auto A = dot(d, d);
@@ -82,30 +127,94 @@ public:
         auto disc = B*B - 4 * A*C;
 
         if (disc < 0) // doesn't hit
-        {
-            return{};
-        }
-        else { // hits 
-            auto distp = (-B + std::sqrt(disc)) / (2 * A);
-            auto dists = (-B - std::sqrt(disc)) / (2 * A);
+            return -1.f;
+
+        auto distp = (-B + std::sqrt(disc)) / (2 * A);
+        auto dists = (-B - std::sqrt(disc)) / (2 * A);
+
+        if (dists < 0 && distp < 0)
+            return -1.f;
 
-            if (dists < 0 && distp < 0)
-                return{};
+        return (dists > 0) ? dists : distp;
+    }
 
-            auto dist = (dists > 0) ? dists : distp;
+    virtual intersection intersect(const ray& r) const override {
+        auto dist = hit_test(r);
+        if (dist < 0)
+            return{};
+        else
             return{ dist, ((r.e + r.dir * dist) - c).normalized() };
-        }
+    }
+
+    virtual bool occludes(const ray& r, float tmax) const override {
+        auto dist = hit_test(r);
+        return dist >= 0 && dist < tmax;
+    }
+
+    virtual aabb bounds() const override {
+        auto radius = std::sqrt(rsq);
+        return{ c - radius, c + radius };
+    }
+
+    virtual void flatten(scene& s) const override {
+        s.add_sphere(c, rsq, s.add_material(mat));
     }
 };
 
-auto make_sphere(const pos& p, float r, material mat = materials::red) {
+// A placed copy of geometry flattened once into a scene of its own, see
+// instance in scene.h. Without a material the geometry keeps its own.
+class instanced : public object {
+private:
+    const std::shared_ptr<const scene> geometry;
+    const affine to_world;
+    const affine to_object;
+    const bool override_material;
+public:
+    instanced(std::shared_ptr<const scene> geometry, const affine& to_world, const material* mat) :
+        object(mat ? *mat : materials::white)
+        , geometry(std::move(geometry))
+        , to_world(to_world)
+        , to_object(to_world.inverse())
+        , override_material(mat != nullptr) {}
+
+    virtual intersection intersect(const ray& r) const override {
+        const auto dir = to_object.vector(r.dir);
+        auto h = geometry->closest_hit(ray{ to_object.point(r.e), dir }).second;
+        if (!h.valid)
+            return{};
+        return{ h.d / dir.len(), to_object.transposed_vector(h.n).normalized() };
+    }
+
+    virtual bool occludes(const ray& r, float tmax) const override {
+        const auto dir = to_object.vector(r.dir);
+        return geometry->occluded(ray{ to_object.point(r.e), dir }, tmax * dir.len());
+    }
+
+    virtual aabb bounds() const override {
+        return to_world.bounds(geometry->bounds());
+    }
+
+    virtual void flatten(scene& s) const override {
+        s.add_instance(geometry, to_world, override_material ? s.add_material(mat) : scene::no_material);
+    }
+};
+
+inline auto make_sphere(const pos& p, float r, material mat = materials::red) {
     return std::make_shared<sphere>(p, r, mat);
 }
 
-auto make_triangle(const pos& a, const pos& b, const pos& c, material mat = materials::white) {
+inline auto make_triangle(const pos& a, const pos& b, const pos& c, material mat = materials::white) {
     return std::make_shared<triangle>(a, b, c, mat);
 }
 
-auto make_plane(const pos& a, const pos& b, const pos& c, const pos& d, material mat = materials::white) {
+inline auto make_plane(const pos& a, const pos& b, const pos& c, const pos& d, material mat = materials::white) {
     return std::make_shared<plane>(a, b, c, d, mat);
 }
+
+inline auto make_instance(std::shared_ptr<const scene> geometry, const affine& to_world) {
+    return std::make_shared<instanced>(std::move(geometry), to_world, nullptr);
+}
+
+inline auto make_instance(std::shared_ptr<const scene> geometry, const affine& to_world, const material& mat) {
+    return std::make_shared<instanced>(std::move(geometry), to_world, &mat);
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include "genvec.h"
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+using genvec::pos;
+using genvec::fvec3;
+
+// Side planes of the pyramid spanned by a tile of primary rays, plus a near
+// plane through the apex. Everything the tile can see is on the positive side
+// of all five planes, so anything fully behind one of them can be skipped for
+// the whole tile.
+struct frustum
+{
+    static const int plane_count = 5;
+
+    frustum() {}
+
+    // corners are the directions through the four tile corners, in order
+    // around the tile
+    frustum(const pos& origin, const fvec3 corners[4]) {
+        ox = origin[0]; oy = origin[1]; oz = origin[2];
+        auto center = (corners[0] + corners[1] + corners[2] + corners[3]).normalized();
+        for (auto i = 0; i < 4; i++) {
+            auto n = genvec::cross(corners[i], corners[(i + 1) % 4]).normalized();
+            if (genvec::dot(n, center) < 0) n = n * -1.f;
+            set_plane(i, n);
+        }
+        set_plane(4, center);
+    }
+
+    // true when the box is completely outside one of the planes
+    bool misses_box(const float lo[3], const float hi[3]) const {
+        for (auto i = 0; i < plane_count; i++) {
+            // the box corner furthest along the plane normal
+            auto px = (nx[i] > 0 ? hi[0] : lo[0]) - ox;
+            auto py = (ny[i] > 0 ? hi[1] : lo[1]) - oy;
+            auto pz = (nz[i] > 0 ? hi[2] : lo[2]) - oz;
+            if (nx[i] * px + ny[i] * py + nz[i] * pz < 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool misses_sphere(float cx, float cy, float cz, float rsq) const {
+        for (auto i = 0; i < plane_count; i++) {
+            auto dist = nx[i] * (cx - ox) + ny[i] * (cy - oy) + nz[i] * (cz - oz);
+            if (dist < 0 && dist * dist > rsq)
+                return true;
+        }
+        return false;
+    }
+
+    // triangle given as a vertex and its two edges
+    bool misses_triangle(float ax, float ay, float az, float e1x, float e1y, float e1z, float e2x, float e2y, float e2z) const {
+        for (auto i = 0; i < plane_count; i++) {
+            auto a = nx[i] * (ax - ox) + ny[i] * (ay - oy) + nz[i] * (az - oz);
+            auto b = a + nx[i] * e1x + ny[i] * e1y + nz[i] * e1z;
+            auto c = a + nx[i] * e2x + ny[i] * e2y + nz[i] * e2z;
+            if (a < 0 && b < 0 && c < 0)
+                return true;
+        }
+        return false;
+    }
+
+    float nx[plane_count], ny[plane_count], nz[plane_count];
+    float ox, oy, oz;
+
+private:
+    void set_plane(int i, const fvec3& n) {
+        nx[i] = n[0]; ny[i] = n[1]; nz[i] = n[2];
+    }
+};
+
+// A square tile of primary rays that share the camera position, filled in
+// by camera::castPacket. Lane y * dim + x holds pixel (x0 + x, y0 + y); lanes
+// past the image edge are padding with t = 0 so they never record a hit.
+struct ray_packet
+{
+    static const int dim = 8;
+    static const int size = dim * dim;
+
+    // true if at least one ray can enter the box before its current t
+    bool reaches(const float lo[3], const float hi[3]) const {
+        const float o[3] = { ox, oy, oz };
+        for (auto lane = 0; lane < size; lane++) {
+            auto t0 = 0.f;
+            auto t1 = t[lane];
+            const float inv[3] = { ix[lane], iy[lane], iz[lane] };
+            for (auto i = 0; i < 3; i++) {
+                auto a = (lo[i] - o[i]) * inv[i];
+                auto b = (hi[i] - o[i]) * inv[i];
+                if (inv[i] < 0) std::swap(a, b);
+                t0 = a > t0 ? a : t0;
+                t1 = b < t1 ? b : t1;
+            }
+            if (t0 <= t1 && t0 < t[lane])
+                return true;
+        }
+        return false;
+    }
+
+    int x0, y0;
+    int width, height; // pixels actually covered
+
+    float ox, oy, oz;
+    alignas(32) float dx[size];
+    alignas(32) float dy[size];
+    alignas(32) float dz[size];
+    alignas(32) float ix[size]; // 1 / d, for the box tests
+    alignas(32) float iy[size];
+    alignas(32) float iz[size];
+
+    // closest hit so far, same meaning as the scalar kernels' tmax and hit
+    alignas(32) float t[size];
+    alignas(32) uint32_t sphere[size];
+    alignas(32) uint32_t triangle[size];
+
+    frustum bounds;
+    int neg[3]; // direction signs of the tile centre, for traversal order
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include "genvec.h"
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+using genvec::fvec3;
+
+// Conversions for the compact scene layout (see print_layout in scene.h).
+
+// float to IEEE half, rounded to nearest even; too large goes to infinity
+inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const auto sign = static_cast<uint16_t>((x >> 16) & 0x8000);
+    x &= 0x7fffffff;
+    if (x >= 0x7f800000) return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+    if (x >= 0x477ff000) return sign | 0x7c00;
+    if (x < 0x38800000) {
+        // below the smallest normal half, 2^-14
+        if (x < 0x33000000) return sign;
+        const auto shift = 126 - (x >> 23);
+        const auto m = (x & 0x7fffff) | 0x800000;
+        auto h = m >> shift;
+        const auto rest = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (h & 1))) h++;
+        return static_cast<uint16_t>(sign | h);
+    }
+    auto h = (x - 0x38000000) >> 13;
+    const auto rest = x & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+    return static_cast<uint16_t>(sign | h);
+}
+
+inline float half_to_float(uint16_t h) {
+    const auto sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    const auto e = (h >> 10) & 0x1f;
+    const auto m = static_cast<uint32_t>(h & 0x3ff);
+    if (e == 0) {
+        const auto f = m * 5.9604645e-8f; // 2^-24
+        return sign ? -f : f;
+    }
+    const auto x = sign | (e == 31 ? 0x7f800000 | (m << 13) : ((e + 112) << 23) | (m << 13));
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// Unit vectors in 32 bits: the octahedron |x| + |y| + |z| = 1 unfolded onto
+// a square, 16 bits a coordinate, within about 1e-4 of the input.
+namespace octahedral {
+    inline float sign(float v) { return v < 0 ? -1.f : 1.f; }
+
+    inline void fold(float& x, float& y) {
+        const auto ox = x;
+        x = (1 - std::abs(y)) * sign(ox);
+        y = (1 - std::abs(ox)) * sign(y);
+    }
+
+    inline uint32_t quantize(float v) {
+        const auto q = static_cast<int16_t>(std::lround(std::min(1.f, std::max(-1.f, v)) * 32767));
+        return static_cast<uint16_t>(q);
+    }
+}
+
+inline uint32_t encode_normal(const fvec3& n) {
+    const auto l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+    auto x = n[0] / l1, y = n[1] / l1;
+    if (n[2] < 0) octahedral::fold(x, y);
+    return octahedral::quantize(x) | octahedral::quantize(y) << 16;
+}
+
+inline fvec3 decode_normal(uint32_t v) {
+    auto x = static_cast<int16_t>(v & 0xffff) / 32767.f;
+    auto y = static_cast<int16_t>(v >> 16) / 32767.f;
+    const auto z = 1 - std::abs(x) - std::abs(y);
+    if (z < 0) octahedral::fold(x, y);
+    return fvec3{ x, y, z }.normalized();
+}
@@ -0,0 +1,132 @@
+#include "stdafx.h"
+#include "profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace profiler {
+    bool enabled = false;
+    thread_local thread_data* current = nullptr;
+
+    namespace {
+        // threads that ended keep their data here until the program does
+        std::mutex registry_lock;
+        std::vector<std::unique_ptr<thread_data>> registry;
+        int64_t origin_ns = 0;
+
+        const char* const names[counter_count] = {
+            "primary rays", "reflection rays", "shadow rays", "sphere tests",
+            "triangle tests", "hits", "occluded", "pixel samples",
+        };
+
+        double ms(int64_t ns) {
+            return ns / 1e6;
+        }
+    }
+
+    const char* counter_name(counter c)
+    {
+        return names[c];
+    }
+
+    thread_data* register_thread()
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        registry.push_back(std::make_unique<thread_data>());
+        auto& data = *registry.back();
+        data.id = static_cast<int>(registry.size()) - 1;
+        std::fill(std::begin(data.counters), std::end(data.counters), 0);
+        return &data;
+    }
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void start()
+    {
+        origin_ns = now_ns();
+        enabled = true;
+        local(); // the calling thread gets id 0
+    }
+
+    void print_summary(std::ostream& out, int pixels)
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        const auto flags = out.flags();
+        out << std::fixed << std::setprecision(2);
+
+        out << std::left << std::setw(18) << "counter" << std::right << std::setw(16) << "total" << std::setw(12) << "per pixel"
+            << std::setw(14) << "thread min" << std::setw(14) << "thread max" << std::endl;
+        for (auto c = 0; c < counter_count; c++) {
+            auto total = uint64_t{ 0 }, lo = UINT64_MAX, hi = uint64_t{ 0 };
+            for (const auto& t : registry) {
+                const auto n = t->counters[c];
+                total += n;
+                // threads that never saw this counter do not count as idle
+                if (n == 0) continue;
+                lo = std::min(lo, n);
+                hi = std::max(hi, n);
+            }
+            if (total == 0) continue;
+            out << std::left << std::setw(18) << names[c] << std::right << std::setw(16) << total
+                << std::setw(12) << static_cast<double>(total) / std::max(1, pixels)
+                << std::setw(14) << lo << std::setw(14) << hi << std::endl;
+        }
+        out << std::endl;
+
+        struct stats { size_t count = 0; int64_t total = 0, max = 0; };
+        auto by_name = std::map<std::string, stats>();
+        for (const auto& t : registry) {
+            for (const auto& s : t->spans) {
+                auto& st = by_name[s.name];
+                st.count++;
+                st.total += s.end_ns - s.start_ns;
+                st.max = std::max(st.max, s.end_ns - s.start_ns);
+            }
+        }
+        out << std::left << std::setw(18) << "span" << std::right << std::setw(10) << "count" << std::setw(14) << "total ms"
+            << std::setw(12) << "mean ms" << std::setw(12) << "max ms" << std::endl;
+        for (const auto& kv : by_name) {
+            const auto& st = kv.second;
+            out << std::left << std::setw(18) << kv.first << std::right << std::setw(10) << st.count << std::setw(14) << ms(st.total)
+                << std::setw(12) << ms(st.total) / st.count << std::setw(12) << ms(st.max) << std::endl;
+        }
+        out.flags(flags);
+    }
+
+    bool write_trace(const char* path)
+    {
+        std::lock_guard<std::mutex> guard(registry_lock);
+        auto out = std::ofstream(path);
+        if (!out) return false;
+
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        auto first = true;
+        auto separator = [&]() {
+            out << (first ? "\n" : ",\n");
+            first = false;
+        };
+        for (const auto& t : registry) {
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t->id
+                << ",\"args\":{\"name\":\"" << (t->id == 0 ? "main" : "thread ") << (t->id == 0 ? std::string() : std::to_string(t->id)) << "\"}}";
+            for (const auto& s : t->spans) {
+                separator();
+                out << "{\"name\":\"" << s.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t->id
+                    << ",\"ts\":" << (s.start_ns - origin_ns) / 1e3 << ",\"dur\":" << (s.end_ns - s.start_ns) / 1e3;
+                if (s.arg >= 0)
+                    out << ",\"args\":{\"index\":" << s.arg << "}";
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+}
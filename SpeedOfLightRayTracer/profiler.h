@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <iosfwd>
+#include <cstdint>
+
+// Opt-in counters and timing spans for finding where a render's time goes.
+// Nothing is recorded until start() is called; before that a counter or a
+// scope costs one test of a global flag. Every thread keeps its own
+// counters and spans, registered on first use, so recording never takes a
+// lock or shares a cache line with another thread. Read the totals once
+// the threads that recorded have finished or gone idle.
+// Defining SOL_NO_PROFILE compiles the PROFILE_ macros away altogether.
+namespace profiler {
+    enum counter {
+        primary_rays,
+        reflection_rays,
+        shadow_rays,
+        sphere_tests,    // ray against sphere, packets count every lane
+        triangle_tests,  // ray against triangle, likewise
+        hits,            // closest hit queries that found a surface
+        occluded,        // shadow queries that found something in the way
+        pixel_samples,   // integrator calls, one per sample
+        counter_count
+    };
+
+    const char* counter_name(counter c);
+
+    struct span {
+        const char* name; // a string literal, never copied
+        int64_t arg;      // tile or row index, -1 for none
+        int64_t start_ns, end_ns;
+    };
+
+    struct thread_data {
+        int id;
+        uint64_t counters[counter_count];
+        std::vector<span> spans;
+    };
+
+    extern bool enabled;
+    extern thread_local thread_data* current;
+    thread_data* register_thread();
+    int64_t now_ns();
+
+    // turns recording on; call before the threads to be measured start
+    void start();
+
+    inline thread_data& local() {
+        if (!current) current = register_thread();
+        return *current;
+    }
+
+    inline void add(counter c, uint64_t n) {
+        if (enabled) local().counters[c] += n;
+    }
+
+    // records a span from construction to destruction on this thread
+    class scope
+    {
+    public:
+        explicit scope(const char* name, int64_t arg = -1) : name(name), arg(arg), start_ns(enabled ? now_ns() : 0) {}
+        ~scope() { stop(); }
+
+        // ends the span early, for spans that do not match a block
+        void stop() {
+            if (enabled && start_ns) local().spans.push_back(span{ name, arg, start_ns, now_ns() });
+            start_ns = 0;
+        }
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        const char* name;
+        int64_t arg;
+        int64_t start_ns;
+    };
+
+    // counter totals with the spread over threads, then every span name
+    // with its count, total, mean and longest duration
+    void print_summary(std::ostream& out, int pixels);
+
+    // all spans as Chrome trace_event JSON ("X" events in microseconds, one
+    // row per thread), for chrome://tracing or ui.perfetto.dev
+    bool write_trace(const char* path);
+}
+
+#define PROFILE_CAT_(a, b) a##b
+#define PROFILE_CAT(a, b) PROFILE_CAT_(a, b)
+// PROFILE_SPAN names its scope so PROFILE_STOP can end it before the block does
+#ifdef SOL_NO_PROFILE
+#define PROFILE_COUNT(c, n) ((void)0)
+#define PROFILE_SCOPE(...) ((void)0)
+#define PROFILE_SPAN(var, ...) ((void)0)
+#define PROFILE_STOP(var) ((void)0)
+#else
+#define PROFILE_COUNT(c, n) ::profiler::add(::profiler::c, (n))
+#define PROFILE_SCOPE(...) ::profiler::scope PROFILE_CAT(profile_scope_, __LINE__)(__VA_ARGS__)
+#define PROFILE_SPAN(var, ...) ::profiler::scope var(__VA_ARGS__)
+#define PROFILE_STOP(var) var.stop()
+#endif
@@ -0,0 +1,123 @@
+#include "stdafx.h"
+#include "progressive.h"
+#include "sampler.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+namespace {
+    using steady_clock = std::chrono::steady_clock;
+
+    struct worker_state {
+        sampler smp;
+        ray_counts counts;
+    };
+
+    // shadow samples are spread over this many passes when the pass count is open
+    const int open_passes = 8;
+}
+
+void render_progressive(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed, tile_scheduler& scheduler, const progressive_settings& progressive, const std::atomic<bool>& cancel, const std::function<void(const std::vector<rgb>&)>& snapshot, std::vector<rgb>& img, ray_counts& counts, aux_buffers& aux, cost_map& costs)
+{
+    const auto start = steady_clock::now();
+    auto seconds = [&]() { return std::chrono::duration<double>(steady_clock::now() - start).count(); };
+    auto stopped = [&]() {
+        return cancel.load() || (progressive.time_limit > 0 && seconds() >= progressive.time_limit);
+    };
+
+    auto pass_settings = settings;
+    pass_settings.shadow_samples = std::max(1, settings.shadow_samples / (progressive.passes > 0 ? progressive.passes : open_passes));
+
+    const auto pixels = size[0] * size[1];
+    auto sum = std::vector<rgb>(pixels, rgb{ 0,0,0 });
+    auto samples = std::vector<int>(pixels, 0);
+
+    std::mutex counts_lock;
+    auto make_state = [&]() { return worker_state{ sampler{ settings.pattern, seed } }; };
+    auto finish = [&](worker_state& w) {
+        std::lock_guard<std::mutex> guard(counts_lock);
+        counts += w.counts;
+    };
+    // tiles that start after the deadline or a cancel do nothing, except
+    // in the pass that first covers the image, which always runs to the end
+    auto run_pass = [&](bool covering, auto&& work) {
+        scheduler.run(make_state, [&](const tile& t, worker_state& w) {
+            if (covering || !stopped()) work(t, w);
+        }, finish);
+    };
+
+    // img keeps the preview where a pixel has no full sample yet
+    auto compose = [&]() {
+        for (auto i = 0; i < pixels; i++) {
+            if (samples[i] > 0)
+                img[i] = sum[i] / static_cast<float>(samples[i]);
+        }
+    };
+    auto last_snapshot = 0.;
+    auto pass_done = [&](const char* what, int n) {
+        compose();
+        std::cout << what << " " << n << " done at " << seconds() << " s" << std::endl;
+        if (progressive.snapshot_interval > 0 && seconds() - last_snapshot >= progressive.snapshot_interval) {
+            snapshot(img);
+            last_snapshot = seconds();
+        }
+    };
+
+    // without the preview the first full pass is the one that covers the image
+    auto covering = [&](int pass) { return !progressive.preview && pass == 0; };
+
+    const auto quiet = scheduler.quiet;
+    scheduler.quiet = true;
+
+    if (progressive.preview) {
+        for (auto stride = 8; stride > 1 && (stride == 8 || !stopped()); stride /= 2) {
+            // tiles are multiples of 8 pixels, so blocks never cross tiles
+            run_pass(stride == 8, [&](const tile& t, worker_state& w) {
+                for (auto y = t.y0; y < t.y0 + t.height; y += stride) {
+                    for (auto x = t.x0; x < t.x0 + t.width; x += stride) {
+                        const auto from = costs.now();
+                        const auto r = c.castRay(x, y, stride * .5f, stride * .5f);
+                        w.smp.start_pixel(x, y, randutils::hash(stride));
+                        const auto color = trace_path(s, r, pass_settings, w.smp, w.counts);
+                        costs.add(y*size[0] + x, from, costs.now());
+                        for (auto by = y; by < std::min(y + stride, t.y0 + t.height); by++) {
+                            for (auto bx = x; bx < std::min(x + stride, t.x0 + t.width); bx++) {
+                                img[by*size[0] + bx] = color;
+                            }
+                        }
+                    }
+                }
+            });
+            pass_done("preview stride", stride);
+        }
+    }
+
+    for (auto pass = 0; (progressive.passes == 0 || pass < progressive.passes) && (!stopped() || covering(pass)); pass++) {
+        run_pass(covering(pass), [&](const tile& t, worker_state& w) {
+            for (auto y = t.y0; y < t.y0 + t.height; ++y) {
+                for (auto x = t.x0; x < t.x0 + t.width; ++x) {
+                    const auto idx = y*size[0] + x;
+                    const auto from = costs.now();
+                    w.smp.start_pixel(x, y, randutils::hash(pass, 1));
+                    w.smp.start_set(1);
+                    const auto jitter = w.smp.next();
+                    const auto r = c.castRay(x, y, jitter[0], jitter[1]);
+                    const auto hit = s.closest_hit(r);
+                    if (samples[idx] == 0)
+                        aux.record(idx, r, hit);
+                    sum[idx] += trace_path(s, r, hit, pass_settings, w.smp, w.counts);
+                    samples[idx]++;
+                    costs.add(idx, from, costs.now());
+                }
+            }
+        });
+        pass_done("pass", pass + 1);
+    }
+
+    compose();
+    if (cancel.load())
+        std::cout << "cancelled" << std::endl;
+    else if (progressive.time_limit > 0 && seconds() >= progressive.time_limit)
+        std::cout << "out of time" << std::endl;
+    scheduler.quiet = quiet;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "scene.h"
+#include "render_settings.h"
+#include "scheduler.h"
+#include "integrator.h"
+#include "denoise.h"
+#include "heatmap.h"
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+using genvec::rgb;
+
+struct progressive_settings
+{
+    double time_limit = 0;        // seconds of wall clock from the start, 0 = no deadline
+    int passes = 8;               // full resolution passes, 0 = until the deadline or a cancel
+    double snapshot_interval = 0; // seconds between snapshots, 0 = none
+    bool preview = true;          // coarse passes at pixel strides 8, 4 and 2 first
+};
+
+// Renders in passes that each refine the whole image a little, so there is
+// always a complete picture to stop at. The preview passes trace one pixel
+// in every stride x stride block and fill the block with it. Every full
+// pass then adds one jittered sample per pixel with settings.shadow_samples
+// spread over the passes, and img is the mean of the samples so far. With
+// the default 8 passes that adds up to one render at full settings.
+// Tiles check the deadline and cancel before they start, so a pass that
+// is cut short leaves some pixels with one sample fewer. The first pass,
+// stride 8 or without the preview the first full pass, ignores them and
+// always finishes, so there is never a hole, and a deadline shorter than
+// that pass is overrun by it.
+// snapshot(img) is called on the calling thread between passes when
+// snapshot_interval has passed, and img always ends up with the best image.
+// A preview sample's cost goes to the pixel it was traced for.
+void render_progressive(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed, tile_scheduler& scheduler, const progressive_settings& progressive, const std::atomic<bool>& cancel, const std::function<void(const std::vector<rgb>&)>& snapshot, std::vector<rgb>& img, ray_counts& counts, aux_buffers& aux, cost_map& costs);
@@ -1,34 +1,83 @@
 #pragma once
 #include <random>
-#include <functional>
+#include <cstdint>
+#include <cmath>
 #include "genvec.h"
 
 namespace randutils {
-    std::random_device devurand;
+    // static so every translation unit that includes this gets its own
+    static std::random_device devurand;
+
+    // splitmix64 finalizer, turns pixel coordinates and seeds into well mixed
+    // 64 bit values
+    inline uint64_t hash(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    inline uint64_t hash(uint64_t a, uint64_t b) {
+        return hash(a ^ hash(b));
+    }
+
+    // 64 bits from the os, for seeding a render
+    inline uint64_t random_seed() {
+        return (uint64_t(devurand()) << 32) | devurand();
+    }
+
+    // PCG32 (XSH RR, O'Neill 2014): 16 bytes of state, a multiply and a
+    // rotate per number. Usable as a std uniform random bit generator.
+    class pcg32
+    {
+    public:
+        using result_type = uint32_t;
+
+        explicit pcg32(uint64_t seed = 0x853c49e6748fea9bull, uint64_t stream = 0xda3e39cb94b95bdbull) {
+            this->seed(seed, stream);
+        }
+
+        void seed(uint64_t seed, uint64_t stream = 0xda3e39cb94b95bdbull) {
+            state = 0;
+            inc = (stream << 1) | 1;
+            (*this)();
+            state += seed;
+            (*this)();
+        }
+
+        uint32_t operator()() {
+            auto old = state;
+            state = old * 6364136223846793005ull + inc;
+            auto xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+            auto rot = static_cast<uint32_t>(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+        }
+
+        // [0, 1), 24 bits so the result never rounds up to 1
+        float uniform() {
+            return ((*this)() >> 8) * (1.f / 16777216.f);
+        }
+
+        static constexpr uint32_t min() { return 0; }
+        static constexpr uint32_t max() { return UINT32_MAX; }
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+    };
 }
 
+// uniform point on the unit sphere from two numbers in [0, 1), by inverting
+// the area (z is uniform on a sphere), no rejection loop
 template<typename T = float>
-auto random_point_on_sphere(std::mt19937_64& mt) {
-    using namespace randutils;
-    using genvec::vec;
-    using std::uniform_real_distribution;
-    
-    uniform_real_distribution<T> d(-1,1);
-    
-    while (true) {
-        using fn = std::function<T()>;
-
-        auto v = vec<T, 4>{ static_cast<fn>([d, &mt]() { return d(mt); }) };
-        auto vsq = v * v;
-
-        auto lensq = vsq.sum();
-        if (lensq >= 1) continue;
-
-        auto invlensq = 1.0f / lensq;
-
-        auto x = 2.f*(v[1]   * v[3]   +   v[0] * v[2]  ) * invlensq;
-        auto y = 2.f*(vsq[2] * vsq[3] - vsq[0] * vsq[1]) * invlensq;
-        auto z =     (vsq[0] * vsq[3] - vsq[1] * vsq[2]) * invlensq;
-        return vec<T, 3> { x, y, z };
-    }
-}
\ No newline at end of file
+genvec::vec<T, 3> sphere_direction(T u1, T u2) {
+    const auto z = 1 - 2 * u1;
+    const auto r = std::sqrt(std::max(T(0), 1 - z * z));
+    const auto phi = T(6.283185307179586) * u2;
+    return genvec::vec<T, 3>{ r * std::cos(phi), r * std::sin(phi), z };
+}
+
+template<typename T = float>
+genvec::vec<T, 3> random_point_on_sphere(randutils::pcg32& rng) {
+    return sphere_direction<T>(rng.uniform(), rng.uniform());
+}
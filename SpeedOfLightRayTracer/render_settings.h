@@ -0,0 +1,77 @@
+#pragma once
+#include "sampler.h"
+
+// Quality knobs for the integrators, set from the command line.
+struct render_settings
+{
+    int max_depth = 10;          // surfaces a path may hit, 1 = no reflections
+    int reflection_samples = 1;  // reflection rays at the first hit, deeper hits use one
+    int shadow_samples = 100;    // per light at the first hit, halved every bounce
+    float reflection_spread = 100; // larger is sharper, only used with several reflection samples
+    float shadow_spread = 20;    // larger is harder shadows
+
+    // Adaptive shadow sampling: shadow_samples is the most a light gets.
+    // Rays go out in batches of shadow_min_samples and stop once a batch
+    // leaves every ray agreeing or the variance of the visible fraction
+    // below shadow_variance. 0 always takes every sample. The wavefront
+    // integrator always takes every sample.
+    int shadow_min_samples = 16;
+    float shadow_variance = .001f;
+    sample_pattern pattern = sample_pattern::random;
+
+    // Scenes with more lights than this stop visiting every light at every
+    // hit: each shadow ray picks one light from the scene's light tree
+    // instead, so a hit costs shadow_samples rays however many lights there
+    // are. The adaptive stop then looks at the relative variance of the
+    // estimate rather than the visible fraction.
+    int max_exact_lights = 8;
+
+    // Path termination by throughput, the product of the reflectances along
+    // a path. Below roulette_weight a path survives with probability
+    // throughput / roulette_weight and carries roulette_weight on, so the
+    // image stays unbiased. Below throughput_cutoff it stops: whatever it
+    // could still add is scaled by the throughput, and a surface lit in
+    // full is about as bright as the image gets, so it stays under one
+    // 8 bit step. 0 turns either off.
+    float roulette_weight = .05f;
+    float throughput_cutoff = 1.f / 255;
+
+    // Supersampling, see supersample.h: pixel_samples jittered camera rays
+    // per pixel, then more where the estimated error is above pixel_error,
+    // up to max_pixel_samples per pixel and sample_budget per pixel on
+    // average over the image (0 = no overall limit). 1 and 1 is the single
+    // ray through the pixel centre.
+    int pixel_samples = 1;
+    int max_pixel_samples = 1;
+    float pixel_error = .02f;
+    float sample_budget = 0;
+
+    bool supersampling() const {
+        return pixel_samples > 1 || max_pixel_samples > pixel_samples;
+    }
+
+    // shadow rays per light at a given depth
+    int shadow_samples_at(int depth) const {
+        auto n = shadow_samples;
+        for (auto d = 0; d < depth; d++) {
+            n = (n / 2 > 1) ? n / 2 : 1;
+        }
+        return n;
+    }
+
+    // the integrator knobs only, the pattern and the pixel samples do not
+    // change how a single path is traced
+    bool is_default() const {
+        const auto d = render_settings{};
+        return max_depth == d.max_depth
+            && reflection_samples == d.reflection_samples
+            && shadow_samples == d.shadow_samples
+            && reflection_spread == d.reflection_spread
+            && shadow_spread == d.shadow_spread
+            && shadow_min_samples == d.shadow_min_samples
+            && shadow_variance == d.shadow_variance
+            && max_exact_lights == d.max_exact_lights
+            && roulette_weight == d.roulette_weight
+            && throughput_cutoff == d.throughput_cutoff;
+    }
+};
@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "sampler.h"
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <limits>
+
+namespace {
+    const int mask_size = 64;
+
+    // Kensler's hashed permutation of [0, l), no tables needed
+    uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+        auto w = l - 1;
+        w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+        do {
+            i ^= p; i *= 0xe170893d; i ^= p >> 16; i ^= (i & w) >> 4;
+            i ^= p >> 8; i *= 0x0929eb3f; i ^= p >> 23; i ^= (i & w) >> 1;
+            i *= 1 | p >> 27; i *= 0x6935fa69; i ^= (i & w) >> 11; i *= 0x74dcb303;
+            i ^= (i & w) >> 2; i *= 0x9e501cc3; i ^= (i & w) >> 2; i *= 0xc860a3df;
+            i &= w; i ^= i >> 5;
+        } while (i >= l);
+        return (i + p) % l;
+    }
+
+    uint32_t reverse_bits(uint32_t v) {
+        v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+        v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+        v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+        v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // second Sobol dimension (the first is reverse_bits)
+    uint32_t sobol_y(uint32_t i) {
+        auto r = 0u;
+        for (auto v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+            if (i & 1) r ^= v;
+        }
+        return r;
+    }
+
+    float to_unit(uint32_t bits) {
+        return (bits >> 8) * (1.f / 16777216.f);
+    }
+
+    // Rank mask made by repeatedly filling the emptiest pixel of a torus,
+    // measured with a gaussian energy (the void filling half of
+    // void-and-cluster). Runs once, about a tenth of a second.
+    std::vector<float> make_blue_noise(uint64_t seed) {
+        const auto n = mask_size * mask_size;
+        const auto radius = 5;
+        const auto sigma = 1.5f;
+
+        auto energy = std::vector<float>(n, 0.f);
+        auto rank = std::vector<float>(n, -1.f);
+        auto rng = randutils::pcg32{ seed };
+        auto p = static_cast<int>(rng() % n);
+
+        for (auto r = 0; r < n; r++) {
+            rank[p] = (r + .5f) / n;
+            const auto x0 = p % mask_size, y0 = p / mask_size;
+            for (auto dy = -radius; dy <= radius; dy++) {
+                for (auto dx = -radius; dx <= radius; dx++) {
+                    auto x = (x0 + dx + mask_size) % mask_size;
+                    auto y = (y0 + dy + mask_size) % mask_size;
+                    energy[y * mask_size + x] += std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+                }
+            }
+
+            // the next point goes where the filled pixels are furthest away
+            auto best = std::numeric_limits<float>::max();
+            for (auto i = 0; i < n; i++) {
+                if (rank[i] < 0 && energy[i] < best) {
+                    best = energy[i];
+                    p = i;
+                }
+            }
+        }
+        return rank;
+    }
+
+    // two independent masks, one per sample dimension
+    const std::vector<float>& blue_noise(int channel) {
+        static const std::vector<float> masks[2] = { make_blue_noise(1), make_blue_noise(2) };
+        return masks[channel];
+    }
+}
+
+bool parse_sample_pattern(const char* name, sample_pattern& pattern)
+{
+    if (!strcmp(name, "random")) pattern = sample_pattern::random;
+    else if (!strcmp(name, "stratified")) pattern = sample_pattern::stratified;
+    else if (!strcmp(name, "sobol")) pattern = sample_pattern::sobol;
+    else if (!strcmp(name, "blue-noise")) pattern = sample_pattern::blue_noise;
+    else return false;
+    return true;
+}
+
+const char* sample_pattern_name(sample_pattern pattern)
+{
+    switch (pattern) {
+    case sample_pattern::stratified: return "stratified";
+    case sample_pattern::sobol: return "sobol";
+    case sample_pattern::blue_noise: return "blue-noise";
+    default: return "random";
+    }
+}
+
+sampler::sampler(sample_pattern pattern, uint64_t seed)
+    : pattern(pattern)
+    , seed(seed)
+{
+    if (pattern == sample_pattern::blue_noise)
+        blue_noise(0); // build the masks now rather than inside the first pixel
+}
+
+void sampler::start_pixel(int x, int y, uint64_t stream)
+{
+    px = x;
+    py = y;
+    pixel_seed = randutils::hash(seed, randutils::hash((uint64_t(uint32_t(y)) << 32) | uint32_t(x), stream));
+    rng.seed(pixel_seed);
+    dimension = 0;
+    set_count = 1;
+    set_index = 0;
+}
+
+void sampler::start_set(int count)
+{
+    set_count = count > 1 ? static_cast<uint32_t>(count) : 1;
+    set_index = 0;
+    dimension++;
+
+    const auto h = randutils::hash(pixel_seed, dimension);
+    scramble[0] = static_cast<uint32_t>(h);
+    scramble[1] = static_cast<uint32_t>(h >> 32);
+
+    if (pattern == sample_pattern::blue_noise) {
+        // every dimension reads the masks at its own offset, the same for all pixels
+        const auto offset = randutils::hash(seed, dimension);
+        const auto x = (px + static_cast<int>(offset % mask_size)) % mask_size;
+        const auto y = (py + static_cast<int>((offset >> 16) % mask_size)) % mask_size;
+        shift[0] = blue_noise(0)[y * mask_size + x];
+        shift[1] = blue_noise(1)[y * mask_size + x];
+    }
+}
+
+genvec::fvec<2> sampler::next()
+{
+    const auto i = set_index++ % set_count;
+    switch (pattern) {
+    case sample_pattern::stratified: {
+        // both axes permuted, so any prefix of a set is still an unbiased
+        // subset of the strata (adaptive sampling stops early)
+        const auto n = static_cast<float>(set_count);
+        auto u = (permute(i, set_count, scramble[1]) + rng.uniform()) / n;
+        auto v = (permute(i, set_count, scramble[0]) + rng.uniform()) / n;
+        return{ u, v };
+    }
+    case sample_pattern::sobol:
+        return{ to_unit(reverse_bits(i) ^ scramble[0]), to_unit(sobol_y(i) ^ scramble[1]) };
+    case sample_pattern::blue_noise: {
+        auto u = to_unit(reverse_bits(i)) + shift[0];
+        auto v = to_unit(sobol_y(i)) + shift[1];
+        return{ u >= 1 ? u - 1 : u, v >= 1 ? v - 1 : v };
+    }
+    default:
+        return{ rng.uniform(), rng.uniform() };
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "genvec.h"
+#include "randutils.h"
+#include <cstdint>
+
+enum class sample_pattern { random, stratified, sobol, blue_noise };
+
+// "random", "stratified", "sobol" or "blue-noise"; false for anything else
+bool parse_sample_pattern(const char* name, sample_pattern& pattern);
+const char* sample_pattern_name(sample_pattern pattern);
+
+// Sample points in [0, 1)^2 for one pixel. A sample loop announces how many
+// points it wants with start_set and takes them with next(). Every set is a
+// new dimension with its own scramble, so different sets are uncorrelated
+// while the points inside a set are spread out according to the pattern:
+//   random      independent PCG32 numbers
+//   stratified  Latin hypercube, one point per row and column of a count x count grid
+//   sobol       first two Sobol dimensions, randomized by digit scrambling
+//   blue_noise  Sobol shifted per pixel by a blue noise mask, so the error
+//               left between neighbouring pixels is high frequency
+// Deterministic for a given seed, pixel and stream, and never allocates.
+class sampler
+{
+public:
+    sampler(sample_pattern pattern, uint64_t seed);
+
+    // stream separates several independent walks through the same pixel
+    void start_pixel(int x, int y, uint64_t stream = 0);
+    void start_set(int count);
+    genvec::fvec<2> next();
+
+    const sample_pattern pattern;
+
+private:
+    uint64_t seed;
+    uint64_t pixel_seed = 0;
+    randutils::pcg32 rng;
+    int px = 0, py = 0;
+    uint32_t dimension = 0;
+    uint32_t set_count = 1;
+    uint32_t set_index = 0;
+    uint32_t scramble[2] = { 0, 0 };
+    float shift[2] = { 0, 0 };
+};
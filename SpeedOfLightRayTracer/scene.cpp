@@ -0,0 +1,421 @@
+#include "stdafx.h"
+#include "scene.h"
+#include "objects.h"
+#include "profiler.h"
+#include <limits>
+#include <algorithm>
+
+using genvec::cross;
+
+namespace {
+    template<typename T>
+    void permute(flat_array<T>& v, const std::vector<uint32_t>& order) {
+        auto sorted = flat_array<T>();
+        sorted.reserve(v.size());
+        for (auto i : order) {
+            sorted.push_back(v[i]);
+        }
+        v.swap(sorted);
+    }
+}
+
+scene::scene(const std::vector<std::shared_ptr<object>>& objects, std::vector<light> lights, bool brute_force, const intersect_kernels& kernels)
+    : lights(std::move(lights))
+    , light_bvh(this->lights)
+    , brute_force(brute_force)
+    , kernels(kernels)
+{
+    for (const auto& obj : objects) {
+        obj->flatten(*this);
+    }
+
+    build_bvhs();
+    bounding_box = measure();
+}
+
+scene::scene(std::vector<material> materials, std::vector<light> lights, sphere_soa spheres, triangle_soa triangles, bvh sphere_bvh, bvh triangle_bvh, bool brute_force, const intersect_kernels& kernels, std::shared_ptr<const void> storage)
+    : materials(std::move(materials))
+    , lights(std::move(lights))
+    , light_bvh(this->lights)
+    , spheres(std::move(spheres))
+    , triangles(std::move(triangles))
+    , sphere_bvh(std::move(sphere_bvh))
+    , triangle_bvh(std::move(triangle_bvh))
+    , brute_force(brute_force)
+    , kernels(kernels)
+    , storage(std::move(storage))
+{
+    bounding_box = measure();
+}
+
+material_index scene::add_material(const material& mat)
+{
+    const auto found = material_ids.find(mat);
+    if (found != material_ids.end())
+        return found->second;
+
+    if (materials.size() > std::numeric_limits<material_index>::max()) {
+        material_overflow = true;
+        return 0;
+    }
+    const auto index = static_cast<material_index>(materials.size());
+    materials.push_back(mat);
+    material_ids.emplace(mat, index);
+    return index;
+}
+
+void scene::add_sphere(const pos& center, float rsq, material_index mat)
+{
+    spheres.cx.push_back(center[0]);
+    spheres.cy.push_back(center[1]);
+    spheres.cz.push_back(center[2]);
+    spheres.rsq.push_back(rsq);
+    spheres.mat.push_back(mat);
+}
+
+void scene::add_triangle(const pos& a, const pos& b, const pos& c, const fvec3& n, material_index mat)
+{
+    auto& t = triangles;
+    auto e1 = b - a;
+    auto e2 = c - a;
+    t.ax.push_back(a[0]); t.ay.push_back(a[1]); t.az.push_back(a[2]);
+    t.e1x.push_back(e1[0]); t.e1y.push_back(e1[1]); t.e1z.push_back(e1[2]);
+    t.e2x.push_back(e2[0]); t.e2y.push_back(e2[1]); t.e2z.push_back(e2[2]);
+    t.n.push_back(encode_normal(n));
+    t.mat.push_back(mat);
+}
+
+void scene::add_mesh(const std::vector<float>& positions, const std::vector<uint32_t>& indices, material_index mat)
+{
+    auto& t = triangles;
+    const auto first = t.size();
+    const auto count = static_cast<int>(indices.size() / 3);
+    auto vertex = [&](uint32_t i) { return pos{ positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2] }; };
+
+    // a slot for every triangle, then each fills its own in parallel;
+    // triangles without area, from repeated indices or three points on a
+    // line, have no normal and are left out
+    auto keep = std::vector<uint32_t>(count + 1, 0);
+    for (auto i = 0; i < count; i++) {
+        const auto* v = &indices[i * 3];
+        const auto a = vertex(v[0]);
+        const auto e1 = vertex(v[1]) - a;
+        const auto e2 = vertex(v[2]) - a;
+        // sine of the angle between the edges below about 1e-6, or an edge of length 0
+        const auto c = cross(e1, e2);
+        const auto area = dot(c, c) > 1e-12f * dot(e1, e1) * dot(e2, e2) && dot(c, c) > 0;
+        keep[i + 1] = keep[i] + (area ? 1 : 0);
+    }
+    const auto n = first + keep[count];
+    for (auto* v : { &t.ax, &t.ay, &t.az, &t.e1x, &t.e1y, &t.e1z, &t.e2x, &t.e2y, &t.e2z }) {
+        v->resize(n);
+    }
+    t.n.resize(n);
+    t.mat.resize(n, mat);
+
+#pragma omp parallel for schedule(static)
+    for (auto i = 0; i < count; i++) {
+        if (keep[i + 1] == keep[i]) continue;
+        const auto* v = &indices[i * 3];
+        const auto a = vertex(v[0]);
+        const auto e1 = vertex(v[1]) - a;
+        const auto e2 = vertex(v[2]) - a;
+        // the same winding as triangle::n
+        const auto normal = cross(e1, e2).normalized();
+        const auto j = first + keep[i];
+        t.ax[j] = a[0]; t.ay[j] = a[1]; t.az[j] = a[2];
+        t.e1x[j] = e1[0]; t.e1y[j] = e1[1]; t.e1z[j] = e1[2];
+        t.e2x[j] = e2[0]; t.e2y[j] = e2[1]; t.e2z[j] = e2[2];
+        t.n[j] = encode_normal(normal);
+    }
+}
+
+void scene::add_instance(std::shared_ptr<const scene> geometry, const affine& object_to_world, uint32_t mat)
+{
+    instances.push_back(instance{ geometry.get(), object_to_world.inverse(), object_to_world.bounds(geometry->bounds()), mat });
+    for (const auto& p : prototypes) {
+        if (p == geometry) return;
+    }
+    prototypes.push_back(std::move(geometry));
+}
+
+void scene::build_bvhs()
+{
+    if (brute_force) return;
+
+    auto bounds = std::vector<aabb>();
+    bounds.reserve(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++) {
+        auto c = pos{ spheres.cx[i], spheres.cy[i], spheres.cz[i] };
+        auto r = std::sqrt(spheres.rsq[i]);
+        bounds.push_back({ c - r, c + r });
+    }
+
+    sphere_bvh = bvh{ bounds, kernels.width };
+    const auto& so = sphere_bvh.order;
+    permute(spheres.cx, so); permute(spheres.cy, so); permute(spheres.cz, so);
+    permute(spheres.rsq, so);
+    permute(spheres.mat, so);
+
+    auto& t = triangles;
+    bounds.clear();
+    bounds.reserve(t.size());
+    for (size_t i = 0; i < t.size(); i++) {
+        auto a = pos{ t.ax[i], t.ay[i], t.az[i] };
+        auto box = aabb{};
+        box.grow(a);
+        box.grow(a + t.e1(i));
+        box.grow(a + t.e2(i));
+        bounds.push_back(box);
+    }
+
+    triangle_bvh = bvh{ bounds, kernels.width };
+    const auto& to = triangle_bvh.order;
+    permute(t.ax, to); permute(t.ay, to); permute(t.az, to);
+    permute(t.e1x, to); permute(t.e1y, to); permute(t.e1z, to);
+    permute(t.e2x, to); permute(t.e2y, to); permute(t.e2z, to);
+    permute(t.n, to);
+    permute(t.mat, to);
+
+    // instances are few and big, one a leaf
+    bounds.clear();
+    for (const auto& inst : instances) {
+        bounds.push_back(inst.box);
+    }
+    instance_bvh = bvh{ bounds };
+    auto sorted = std::vector<instance>();
+    sorted.reserve(instances.size());
+    for (auto i : instance_bvh.order) {
+        sorted.push_back(instances[i]);
+    }
+    instances.swap(sorted);
+}
+
+std::pair<material const*, intersection> scene::closest_hit(const ray& r) const
+{
+    const auto hit = nearest(r, std::numeric_limits<float>::infinity());
+    PROFILE_COUNT(hits, hit.first != nullptr);
+    return hit;
+}
+
+std::pair<material const*, intersection> scene::nearest(const ray& r, float tmax) const
+{
+    const auto fr = flat_ray{ r };
+    auto closest_sphere = no_hit;
+    auto closest_triangle = no_hit;
+
+    auto sphere_leaf = [&](uint32_t first, uint32_t count, float tmax) {
+        PROFILE_COUNT(sphere_tests, count);
+        return kernels.sphere_closest(spheres, first, count, fr, tmax, closest_sphere);
+    };
+
+    // a triangle only gets reported when it is closer than every sphere
+    auto triangle_leaf = [&](uint32_t first, uint32_t count, float tmax) {
+        PROFILE_COUNT(triangle_tests, count);
+        return kernels.triangle_closest(triangles, first, count, fr, tmax, closest_triangle);
+    };
+
+    if (brute_force) {
+        tmax = sphere_leaf(0, static_cast<uint32_t>(spheres.size()), tmax);
+        tmax = triangle_leaf(0, static_cast<uint32_t>(triangles.size()), tmax);
+    }
+    else {
+        tmax = sphere_bvh.closest_hit(r, tmax, sphere_leaf);
+        tmax = triangle_bvh.closest_hit(r, tmax, triangle_leaf);
+    }
+
+    auto hit = std::pair<material const*, intersection>{ nullptr, intersection{} };
+    if (instance_closest(r, tmax, hit) < tmax)
+        return hit;
+    return hit_record(r.e, r.dir, tmax, closest_sphere, closest_triangle);
+}
+
+void scene::closest_hit(ray_packet& p, std::pair<material const*, intersection>* out) const
+{
+    auto sphere_leaf = [&](uint32_t first, uint32_t count) {
+        PROFILE_COUNT(sphere_tests, count * ray_packet::size);
+        kernels.sphere_packet(spheres, first, count, p);
+    };
+
+    auto triangle_leaf = [&](uint32_t first, uint32_t count) {
+        PROFILE_COUNT(triangle_tests, count * ray_packet::size);
+        kernels.triangle_packet(triangles, first, count, p);
+    };
+
+    if (brute_force) {
+        sphere_leaf(0, static_cast<uint32_t>(spheres.size()));
+        triangle_leaf(0, static_cast<uint32_t>(triangles.size()));
+    }
+    else {
+        sphere_bvh.packet_closest_hit(p, sphere_leaf);
+        triangle_bvh.packet_closest_hit(p, triangle_leaf);
+    }
+
+    const auto e = pos{ p.ox, p.oy, p.oz };
+    for (auto lane = 0; lane < ray_packet::size; lane++) {
+        const auto dir = fvec3{ p.dx[lane], p.dy[lane], p.dz[lane] };
+        // instances transform each ray on its own, so lane by lane
+        if (instances.empty() || instance_closest(ray{ e, dir }, p.t[lane], out[lane]) >= p.t[lane])
+            out[lane] = hit_record(e, dir, p.t[lane], p.sphere[lane], p.triangle[lane]);
+        PROFILE_COUNT(hits, out[lane].first != nullptr);
+    }
+}
+
+std::pair<material const*, intersection> scene::hit_record(const pos& e, const fvec3& dir, float t, uint32_t sphere, uint32_t triangle) const
+{
+    // the normal is only worked out for the winner
+    if (triangle != no_hit) {
+        const auto i = triangle;
+        return{ &materials[triangles.mat[i]], intersection{ t, decode_normal(triangles.n[i]) } };
+    }
+    if (sphere != no_hit) {
+        const auto i = sphere;
+        auto c = pos{ spheres.cx[i], spheres.cy[i], spheres.cz[i] };
+        return{ &materials[spheres.mat[i]], intersection{ t, ((e + dir * t) - c).normalized() } };
+    }
+    return{ nullptr, intersection{} };
+}
+
+void scene::store_half_edges()
+{
+    auto& t = triangles;
+    if (t.half_edges() || t.size() == 0) return;
+
+    auto to_half = [&](flat_array<float>& from, flat_array<uint16_t>& to) {
+        to.resize(t.size() + triangle_soa::half_padding, 0);
+        for (size_t i = 0; i < t.size(); i++) {
+            to[i] = float_to_half(from[i]);
+        }
+        from = flat_array<float>();
+    };
+    to_half(t.e1x, t.e1xh); to_half(t.e1y, t.e1yh); to_half(t.e1z, t.e1zh);
+    to_half(t.e2x, t.e2xh); to_half(t.e2y, t.e2yh); to_half(t.e2z, t.e2zh);
+
+    triangle_bvh.refit([&](uint32_t first, uint32_t count) {
+        auto box = aabb{};
+        for (auto i = first; i < first + count; i++) {
+            const auto a = pos{ t.ax[i], t.ay[i], t.az[i] };
+            box.grow(a);
+            box.grow(a + t.e1(i));
+            box.grow(a + t.e2(i));
+        }
+        return box;
+    });
+    bounding_box = measure();
+}
+
+float scene::instance_closest(const ray& r, float tmax, std::pair<material const*, intersection>& hit) const
+{
+    auto leaf = [&](uint32_t first, uint32_t count, float tmax) {
+        for (auto i = first; i < first + count; i++) {
+            const auto& inst = instances[i];
+            // t scales by the length the direction gets in object space
+            const auto dir = inst.world_to_object.vector(r.dir);
+            const auto scale = dir.len();
+            const auto local = ray{ inst.world_to_object.point(r.e), dir };
+            const auto h = inst.geometry->nearest(local, tmax * scale);
+            if (!h.first) continue;
+            tmax = h.second.d / scale;
+            const auto n = inst.world_to_object.transposed_vector(h.second.n).normalized();
+            hit = { inst.mat == no_material ? h.first : &materials[inst.mat], intersection{ tmax, n } };
+        }
+        return tmax;
+    };
+
+    if (instances.empty()) return tmax;
+    if (brute_force) return leaf(0, static_cast<uint32_t>(instances.size()), tmax);
+    return instance_bvh.closest_hit(r, tmax, leaf);
+}
+
+bool scene::instance_any(const ray& r, float tmax) const
+{
+    auto leaf = [&](uint32_t first, uint32_t count, float tmax) {
+        for (auto i = first; i < first + count; i++) {
+            const auto& inst = instances[i];
+            const auto dir = inst.world_to_object.vector(r.dir);
+            if (inst.geometry->blocked(ray{ inst.world_to_object.point(r.e), dir }, tmax * dir.len()))
+                return true;
+        }
+        return false;
+    };
+
+    if (instances.empty()) return false;
+    if (brute_force) return leaf(0, static_cast<uint32_t>(instances.size()), tmax);
+    return instance_bvh.any_hit(r, tmax, leaf);
+}
+
+aabb scene::measure() const
+{
+    auto box = aabb{};
+    for (const auto& inst : instances) {
+        box.grow(inst.box);
+    }
+    for (size_t i = 0; i < spheres.size(); i++) {
+        auto c = pos{ spheres.cx[i], spheres.cy[i], spheres.cz[i] };
+        auto r = std::sqrt(spheres.rsq[i]);
+        box.grow(aabb{ c - r, c + r });
+    }
+
+    const auto& t = triangles;
+    for (size_t i = 0; i < t.size(); i++) {
+        auto a = pos{ t.ax[i], t.ay[i], t.az[i] };
+        box.grow(a);
+        box.grow(a + t.e1(i));
+        box.grow(a + t.e2(i));
+    }
+    return box;
+}
+
+bool scene::occluded(const ray& r, float tmax) const
+{
+    const auto b = blocked(r, tmax);
+    PROFILE_COUNT(occluded, b);
+    return b;
+}
+
+bool scene::blocked(const ray& r, float tmax) const
+{
+    const auto fr = flat_ray{ r };
+
+    auto sphere_leaf = [&](uint32_t first, uint32_t count, float tmax) {
+        PROFILE_COUNT(sphere_tests, count);
+        return kernels.sphere_any(spheres, first, count, fr, tmax);
+    };
+
+    auto triangle_leaf = [&](uint32_t first, uint32_t count, float tmax) {
+        PROFILE_COUNT(triangle_tests, count);
+        return kernels.triangle_any(triangles, first, count, fr, tmax);
+    };
+
+    const auto prims = brute_force
+        ? sphere_leaf(0, static_cast<uint32_t>(spheres.size()), tmax) || triangle_leaf(0, static_cast<uint32_t>(triangles.size()), tmax)
+        : sphere_bvh.any_hit(r, tmax, sphere_leaf) || triangle_bvh.any_hit(r, tmax, triangle_leaf);
+    return prims || instance_any(r, tmax);
+}
+
+void print_layout(std::ostream& out, const scene& s)
+{
+    // the sizes before: float normals and 32 bit material indices
+    const auto old_sphere = 5 * 4;
+    const auto old_triangle = 13 * 4;
+    const auto sphere = 4 * sizeof(float) + sizeof(material_index);
+    const auto triangle = 3 * sizeof(float) + (s.triangles.half_edges() ? 6 * sizeof(uint16_t) : 6 * sizeof(float)) + sizeof(uint32_t) + sizeof(material_index);
+
+    // geometry shared by instances counts once
+    auto spheres = s.spheres.size(), triangles = s.triangles.size();
+    auto nodes = s.sphere_bvh.nodes.size() + s.triangle_bvh.nodes.size() + s.instance_bvh.nodes.size();
+    for (const auto& p : s.prototypes) {
+        spheres += p->spheres.size();
+        triangles += p->triangles.size();
+        nodes += p->sphere_bvh.nodes.size() + p->triangle_bvh.nodes.size();
+    }
+    const auto primitives = std::max<size_t>(1, spheres + triangles);
+    const auto node_bytes = nodes * sizeof(bvh_node) + s.instances.size() * sizeof(instance);
+    const auto bytes = spheres * sphere + triangles * triangle + node_bytes;
+    const auto old_bytes = spheres * old_sphere + triangles * old_triangle + node_bytes;
+
+    out << "layout: " << sphere << " bytes a sphere (" << old_sphere << " before), "
+        << triangle << " bytes a triangle (" << old_triangle << " before), "
+        << static_cast<float>(node_bytes) / primitives << " bytes of bvh and instances a primitive, "
+        << bytes / 1e6 << " MB in all (" << old_bytes / 1e6 << " MB before)" << std::endl;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "material.h"
+#include "light.h"
+#include "intersection.h"
+#include "bvh.h"
+#include "light_tree.h"
+#include "kernels.h"
+#include "affine.h"
+#include <vector>
+#include <memory>
+#include <utility>
+#include <unordered_map>
+#include <cstdint>
+#include <ostream>
+
+class object;
+class scene;
+
+// A shared block of geometry placed in the world. Rays go into the
+// geometry's own space and hits come back out, so any number of instances
+// cost one transform each rather than a copy of the geometry.
+struct instance
+{
+    const scene* geometry; // kept alive by scene::prototypes
+    affine world_to_object;
+    aabb box; // in the world
+    uint32_t mat; // replaces the geometry's materials, or no_material
+};
+
+using genvec::pos;
+using genvec::fvec3;
+
+// A hit in 16 bytes rather than the 64 of the pair closest_hit returns,
+// for queues that keep one a ray. The normal is octahedral encoded.
+struct packed_hit
+{
+    packed_hit() {}
+    packed_hit(const std::pair<material const*, intersection>& hit)
+        : mat(hit.first)
+        , d(hit.second.d)
+        , n(hit.first ? encode_normal(hit.second.n) : 0) {}
+
+    std::pair<material const*, intersection> unpack() const {
+        if (!mat) return{ nullptr, intersection{} };
+        return{ mat, intersection{ d, decode_normal(n) } };
+    }
+
+    material const* mat = nullptr;
+    float d = 0;
+    uint32_t n = 0;
+};
+
+// Flat render-time scene: primitives live in contiguous per-type arrays and
+// refer to a shared material table by index. Built once from the object
+// list that load_scene produces; the objects are not needed afterwards.
+class scene
+{
+public:
+    scene(const std::vector<std::shared_ptr<object>>& objects, std::vector<light> lights, bool brute_force, const intersect_kernels& kernels = best_kernels());
+
+    // a scene that was flattened before, primitives in bvh order; the arrays
+    // may view memory that storage keeps alive, see scene_file.h
+    scene(std::vector<material> materials, std::vector<light> lights, sphere_soa spheres, triangle_soa triangles, bvh sphere_bvh, bvh triangle_bvh, bool brute_force, const intersect_kernels& kernels, std::shared_ptr<const void> storage);
+
+    // called by object::flatten; equal materials share an index. The table
+    // holds up to 65536 materials, past that materials_fit() turns false
+    // and the scene must not be rendered.
+    material_index add_material(const material& mat);
+    bool materials_fit() const { return !material_overflow; }
+    void add_sphere(const pos& center, float rsq, material_index mat);
+    void add_triangle(const pos& a, const pos& b, const pos& c, const fvec3& n, material_index mat);
+    // an indexed mesh, packed xyz positions and three indices a triangle;
+    // degenerate triangles are left out
+    void add_mesh(const std::vector<float>& positions, const std::vector<uint32_t>& indices, material_index mat);
+
+    // places geometry, flattened into a scene of its own, in this one; mat
+    // replaces the geometry's materials unless it is no_material
+    void add_instance(std::shared_ptr<const scene> geometry, const affine& object_to_world, uint32_t mat);
+    static const uint32_t no_material = 0xffffffff;
+
+    // nearest hit, or a null material and an invalid intersection
+    std::pair<material const*, intersection> closest_hit(const ray& r) const;
+
+    // nearest hits for a whole primary packet, out[lane] for every lane
+    void closest_hit(ray_packet& p, std::pair<material const*, intersection>* out) const;
+
+    // true if anything blocks the ray before tmax, used for shadow rays
+    bool occluded(const ray& r, float tmax) const;
+
+    // Stores the triangle edges as halves, 12 bytes a triangle less, and
+    // refits the bvh around them. The vertices move by up to 1/2048 of the
+    // edge length, so neighbouring triangles may no longer meet exactly.
+    void store_half_edges();
+
+    // primitives stored here, not counting the ones instances refer to
+    size_t primitive_count() const { return spheres.size() + triangles.size(); }
+
+    // box around every primitive and instance
+    aabb bounds() const { return bounding_box; }
+
+    std::vector<material> materials;
+    std::vector<light> lights;
+    light_tree light_bvh; // for picking lights when there are too many to visit each
+
+    sphere_soa spheres;
+    triangle_soa triangles;
+    bvh sphere_bvh;
+    bvh triangle_bvh;
+
+    // the top level: instances in instance_bvh order, each geometry once
+    std::vector<instance> instances;
+    std::vector<std::shared_ptr<const scene>> prototypes;
+    bvh instance_bvh;
+
+    // linear scan over every primitive instead of the bvhs, for comparing results
+    const bool brute_force;
+    const intersect_kernels& kernels;
+
+    // owner of the memory the arrays view, if any
+    std::shared_ptr<const void> storage;
+
+private:
+    void build_bvhs();
+    aabb measure() const;
+
+    // bounds(), kept since every instance of this scene asks for it
+    aabb bounding_box;
+
+    // index of every material in the table, for add_material
+    std::unordered_map<material, material_index, material_hash> material_ids;
+    bool material_overflow = false;
+
+    // closest_hit and occluded without the profiler's hit counts, which
+    // instances would otherwise count again for their geometry
+    std::pair<material const*, intersection> nearest(const ray& r, float tmax) const;
+    bool blocked(const ray& r, float tmax) const;
+
+    // the nearest hit on the instances closer than tmax, if any
+    float instance_closest(const ray& r, float tmax, std::pair<material const*, intersection>& hit) const;
+    bool instance_any(const ray& r, float tmax) const;
+
+    // material and normal of the winning primitive
+    std::pair<material const*, intersection> hit_record(const pos& e, const fvec3& dir, float t, uint32_t sphere, uint32_t triangle) const;
+};
+
+// bytes a sphere, a triangle and a bvh node take per primitive, next to what
+// the layout before material indices, packed normals and half edges took
+void print_layout(std::ostream& out, const scene& s);
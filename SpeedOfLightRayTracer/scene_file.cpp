@@ -0,0 +1,480 @@
+#include "stdafx.h"
+#include "scene_file.h"
+#include "mesh.h"
+#include "mapped_file.h"
+#include "randutils.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace {
+    // bump whenever the layout of the cache or of anything in it changes
+    const uint32_t cache_version = 2;
+    const char cache_magic[8] = { 'S', 'O', 'L', 'S', 'C', 'E', 'N', 'E' };
+    const size_t cache_alignment = 64;
+
+    enum section_id {
+        sphere_cx, sphere_cy, sphere_cz, sphere_rsq, sphere_mat,
+        triangle_ax, triangle_ay, triangle_az,
+        triangle_e1x, triangle_e1y, triangle_e1z,
+        triangle_e2x, triangle_e2y, triangle_e2z,
+        triangle_e1xh, triangle_e1yh, triangle_e1zh,
+        triangle_e2xh, triangle_e2yh, triangle_e2zh,
+        triangle_n, triangle_mat,
+        sphere_nodes, triangle_nodes,
+        material_records, light_records, dependency_records, dependency_paths,
+        section_count
+    };
+
+    struct section {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct cache_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t leaf_width;
+        uint64_t key;
+        int32_t resolution[2];
+        float eye[3], target[3], up[3];
+        section sections[section_count];
+    };
+
+    // material and light have const members, so they go through these
+    struct material_record {
+        float alpha, ambient[3], diff[3], spec[3], n, r;
+    };
+
+    struct light_record {
+        float pos[3], color[3];
+    };
+
+    // an obj file the scene was built from, path in dependency_paths
+    struct dependency_record {
+        uint64_t size;
+        int64_t modified;
+        uint64_t path_offset, path_length;
+    };
+
+    struct mesh_reference {
+        std::string path;
+        material mat;
+        bool fit;
+        aabb box;
+    };
+
+    // FNV-1a
+    uint64_t hash_bytes(const void* data, size_t n, uint64_t h = 14695981039346656037ull) {
+        auto p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < n; i++) {
+            h = (h ^ p[i]) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    bool file_stamp(const std::string& path, uint64_t& size, int64_t& modified) {
+#if defined(_MSC_VER)
+        struct _stat64 st;
+        if (_stat64(path.c_str(), &st) != 0) return false;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return false;
+#endif
+        size = static_cast<uint64_t>(st.st_size);
+        modified = static_cast<int64_t>(st.st_mtime);
+        return true;
+    }
+
+    std::string directory_of(const std::string& path) {
+        const auto slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    }
+
+    template<typename T, size_t N>
+    bool read_floats(std::istream& in, T (&out)[N]) {
+        for (auto& v : out) {
+            if (!(in >> v)) return false;
+        }
+        return true;
+    }
+
+    pos to_pos(const float (&v)[3]) {
+        return pos{ v[0], v[1], v[2] };
+    }
+
+    // the text of a scene file into objects, lights, the view and the obj
+    // files still to load; false with a message on the first bad line
+    bool parse_scene(const std::string& text, const std::string& dir, std::vector<std::shared_ptr<object>>& objects, std::vector<light>& lights, scene_view& view, std::vector<mesh_reference>& meshes, std::string& error) {
+        auto named = std::map<std::string, material>{
+            { "red", materials::red }, { "green", materials::green }, { "blue", materials::blue }, { "white", materials::white },
+        };
+        // the material named at the end of a line, white when there is none;
+        // the pointer is only used on the line it was read from
+        auto material_of = [&](std::istream& in, const material*& out) {
+            auto name = std::string();
+            if (!(in >> name)) {
+                out = &materials::white;
+                return true;
+            }
+            auto it = named.find(name);
+            out = it == named.end() ? nullptr : &it->second;
+            return out != nullptr;
+        };
+
+        auto lines = std::istringstream(text);
+        auto line = std::string();
+        for (auto number = 1; std::getline(lines, line); number++) {
+            const auto hash = line.find('#');
+            if (hash != std::string::npos) line.resize(hash);
+            auto in = std::istringstream(line);
+            auto word = std::string();
+            if (!(in >> word)) continue;
+
+            auto ok = true;
+            const material* mat = &materials::white;
+            if (word == "resolution") {
+                ok = static_cast<bool>(in >> view.resolution[0] >> view.resolution[1]) && view.resolution[0] > 0 && view.resolution[1] > 0;
+            }
+            else if (word == "camera") {
+                float v[9];
+                ok = read_floats(in, v);
+                if (ok) {
+                    view.eye = pos{ v[0], v[1], v[2] };
+                    view.target = pos{ v[3], v[4], v[5] };
+                    view.up = fvec3{ v[6], v[7], v[8] };
+                }
+            }
+            else if (word == "material") {
+                auto name = std::string();
+                float v[12];
+                ok = static_cast<bool>(in >> name) && read_floats(in, v);
+                if (ok) {
+                    named.erase(name);
+                    named.emplace(name, material{ v[0], { v[1], v[2], v[3] }, { v[4], v[5], v[6] }, { v[7], v[8], v[9] }, v[10], v[11] });
+                }
+            }
+            else if (word == "light") {
+                float v[6];
+                ok = read_floats(in, v);
+                if (ok) lights.push_back(light{ pos{ v[0], v[1], v[2] }, rgb{ v[3], v[4], v[5] } });
+            }
+            else if (word == "sphere") {
+                float v[4];
+                ok = read_floats(in, v) && material_of(in, mat);
+                if (ok) objects.push_back(make_sphere(pos{ v[0], v[1], v[2] }, v[3], *mat));
+            }
+            else if (word == "triangle") {
+                float a[3], b[3], c[3];
+                ok = read_floats(in, a) && read_floats(in, b) && read_floats(in, c) && material_of(in, mat);
+                if (ok) objects.push_back(make_triangle(to_pos(a), to_pos(b), to_pos(c), *mat));
+            }
+            else if (word == "plane") {
+                float a[3], b[3], c[3], d[3];
+                ok = read_floats(in, a) && read_floats(in, b) && read_floats(in, c) && read_floats(in, d) && material_of(in, mat);
+                if (ok) objects.push_back(make_plane(to_pos(a), to_pos(b), to_pos(c), to_pos(d), *mat));
+            }
+            else if (word == "obj") {
+                auto path = std::string();
+                ok = static_cast<bool>(in >> path);
+                auto rest = std::string();
+                auto fit = false;
+                float lo[3], hi[3];
+                // an optional material, then an optional fit box
+                if (ok && in >> rest) {
+                    if (rest != "fit") {
+                        auto it = named.find(rest);
+                        ok = it != named.end();
+                        if (ok) mat = &it->second;
+                        rest.clear();
+                        in >> rest;
+                    }
+                    if (ok && rest == "fit") {
+                        fit = true;
+                        ok = read_floats(in, lo) && read_floats(in, hi);
+                    }
+                    else if (ok && !rest.empty()) {
+                        ok = false;
+                    }
+                }
+                if (ok) meshes.push_back(mesh_reference{ dir + path, *mat, fit, fit ? aabb{ to_pos(lo), to_pos(hi) } : aabb{} });
+            }
+            else {
+                error = "line " + std::to_string(number) + ": unknown statement " + word;
+                return false;
+            }
+
+            if (!ok) {
+                error = "line " + std::to_string(number) + ": cannot read " + word + " (missing numbers or an unknown material)";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename T>
+    void put(std::ofstream& out, section& s, const T* data, size_t count) {
+        auto at = static_cast<uint64_t>(out.tellp());
+        const auto padding = (cache_alignment - at % cache_alignment) % cache_alignment;
+        static const char zeros[cache_alignment] = {};
+        out.write(zeros, padding);
+        s.offset = at + padding;
+        s.count = count;
+        if (count > 0)
+            out.write(reinterpret_cast<const char*>(data), sizeof(T) * count);
+    }
+
+    template<typename T>
+    void put(std::ofstream& out, section& s, const flat_array<T>& a) {
+        put(out, s, a.data(), a.size());
+    }
+
+    bool write_cache_file(const std::string& path, uint64_t key, const scene& s, const scene_view& view, const std::vector<mesh_reference>& meshes) {
+        auto out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+
+        auto header = cache_header{};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.leaf_width = static_cast<uint32_t>(s.kernels.width);
+        header.key = key;
+        header.resolution[0] = view.resolution[0];
+        header.resolution[1] = view.resolution[1];
+        for (auto i = 0; i < 3; i++) {
+            header.eye[i] = view.eye[i];
+            header.target[i] = view.target[i];
+            header.up[i] = view.up[i];
+        }
+        // written again at the end with the sections filled in
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        auto& sec = header.sections;
+        const auto& sp = s.spheres;
+        put(out, sec[sphere_cx], sp.cx); put(out, sec[sphere_cy], sp.cy); put(out, sec[sphere_cz], sp.cz);
+        put(out, sec[sphere_rsq], sp.rsq); put(out, sec[sphere_mat], sp.mat);
+        const auto& t = s.triangles;
+        put(out, sec[triangle_ax], t.ax); put(out, sec[triangle_ay], t.ay); put(out, sec[triangle_az], t.az);
+        put(out, sec[triangle_e1x], t.e1x); put(out, sec[triangle_e1y], t.e1y); put(out, sec[triangle_e1z], t.e1z);
+        put(out, sec[triangle_e2x], t.e2x); put(out, sec[triangle_e2y], t.e2y); put(out, sec[triangle_e2z], t.e2z);
+        put(out, sec[triangle_e1xh], t.e1xh); put(out, sec[triangle_e1yh], t.e1yh); put(out, sec[triangle_e1zh], t.e1zh);
+        put(out, sec[triangle_e2xh], t.e2xh); put(out, sec[triangle_e2yh], t.e2yh); put(out, sec[triangle_e2zh], t.e2zh);
+        put(out, sec[triangle_n], t.n);
+        put(out, sec[triangle_mat], t.mat);
+        put(out, sec[sphere_nodes], s.sphere_bvh.nodes);
+        put(out, sec[triangle_nodes], s.triangle_bvh.nodes);
+
+        auto mats = std::vector<material_record>();
+        for (const auto& m : s.materials) {
+            auto r = material_record{ m.alpha, { m.ambient[0], m.ambient[1], m.ambient[2] }, { m.diff[0], m.diff[1], m.diff[2] },
+                { m.spec[0], m.spec[1], m.spec[2] }, m.n, m.r };
+            mats.push_back(r);
+        }
+        put(out, sec[material_records], mats.data(), mats.size());
+
+        auto lights = std::vector<light_record>();
+        for (const auto& l : s.lights) {
+            lights.push_back(light_record{ { l.pos[0], l.pos[1], l.pos[2] }, { l.color[0], l.color[1], l.color[2] } });
+        }
+        put(out, sec[light_records], lights.data(), lights.size());
+
+        auto deps = std::vector<dependency_record>();
+        auto paths = std::string();
+        for (const auto& m : meshes) {
+            auto d = dependency_record{ 0, 0, paths.size(), m.path.size() };
+            file_stamp(m.path, d.size, d.modified);
+            deps.push_back(d);
+            paths += m.path;
+        }
+        put(out, sec[dependency_records], deps.data(), deps.size());
+        put(out, sec[dependency_paths], paths.data(), paths.size());
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        return static_cast<bool>(out);
+    }
+
+    // Other renders may have the old cache mapped, and truncating a mapped
+    // file takes their pages away. So the cache is written next to the old
+    // one under a name of its own and then renamed over it.
+    bool write_cache(const std::string& path, uint64_t key, const scene& s, const scene_view& view, const std::vector<mesh_reference>& meshes) {
+        const auto tmp = path + "." + std::to_string(randutils::random_seed() % 1000000000) + ".tmp";
+        if (write_cache_file(tmp, key, s, view, meshes) && replace_file(tmp.c_str(), path.c_str()))
+            return true;
+        std::remove(tmp.c_str());
+        return false;
+    }
+
+    // The walks index the primitive arrays, the child nodes and their fixed
+    // size stacks with whatever the nodes say, so a damaged tree has to be
+    // caught before it is used.
+    bool nodes_fit(const flat_array<bvh_node>& nodes, size_t primitives) {
+        auto depth = std::vector<int>(nodes.size(), 0);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const auto& n = nodes[i];
+            if (n.leaf()) {
+                if (n.offset > primitives || n.count > primitives - n.offset) return false;
+                continue;
+            }
+            // children come after their parent, so every walk moves forward
+            if (n.axis > 2 || i + 1 >= nodes.size() || n.offset <= i + 1 || n.offset >= nodes.size()
+                || depth[i] + 1 >= bvh::max_depth)
+                return false;
+            depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+            depth[n.offset] = std::max(depth[n.offset], depth[i] + 1);
+        }
+        return true;
+    }
+
+    // the scene straight from a mapped cache, or null when the cache is
+    // missing, damaged, for other leaf widths or out of date
+    std::unique_ptr<scene> map_cache(const std::string& path, uint64_t key, const intersect_kernels& kernels, scene_view& view) {
+        auto file = std::make_shared<mapped_file>();
+        if (!file->open(path.c_str()) || file->size() < sizeof(cache_header)) return nullptr;
+
+        const auto base = file->data();
+        const auto& header = *reinterpret_cast<const cache_header*>(base);
+        if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version
+            || header.key != key || header.leaf_width != static_cast<uint32_t>(kernels.width))
+            return nullptr;
+
+        auto fits = true;
+        auto view_of = [&](section_id id, auto* type) {
+            using T = std::remove_pointer_t<decltype(type)>;
+            const auto& s = header.sections[id];
+            const auto ok = s.offset % alignof(T) == 0 && s.offset <= file->size() && s.count <= (file->size() - s.offset) / sizeof(T);
+            fits = fits && ok;
+            return ok ? flat_array<T>::view_of(reinterpret_cast<const T*>(base + s.offset), static_cast<size_t>(s.count)) : flat_array<T>();
+        };
+        const auto f = static_cast<float*>(nullptr);
+        const auto u = static_cast<uint32_t*>(nullptr);
+        const auto h = static_cast<uint16_t*>(nullptr);
+        const auto mi = static_cast<material_index*>(nullptr);
+
+        auto sp = sphere_soa{};
+        sp.cx = view_of(sphere_cx, f); sp.cy = view_of(sphere_cy, f); sp.cz = view_of(sphere_cz, f);
+        sp.rsq = view_of(sphere_rsq, f); sp.mat = view_of(sphere_mat, mi);
+        auto t = triangle_soa{};
+        t.ax = view_of(triangle_ax, f); t.ay = view_of(triangle_ay, f); t.az = view_of(triangle_az, f);
+        t.e1x = view_of(triangle_e1x, f); t.e1y = view_of(triangle_e1y, f); t.e1z = view_of(triangle_e1z, f);
+        t.e2x = view_of(triangle_e2x, f); t.e2y = view_of(triangle_e2y, f); t.e2z = view_of(triangle_e2z, f);
+        t.e1xh = view_of(triangle_e1xh, h); t.e1yh = view_of(triangle_e1yh, h); t.e1zh = view_of(triangle_e1zh, h);
+        t.e2xh = view_of(triangle_e2xh, h); t.e2yh = view_of(triangle_e2yh, h); t.e2zh = view_of(triangle_e2zh, h);
+        t.n = view_of(triangle_n, u);
+        t.mat = view_of(triangle_mat, mi);
+        auto sphere_bvh = bvh{ view_of(sphere_nodes, static_cast<bvh_node*>(nullptr)) };
+        auto triangle_bvh = bvh{ view_of(triangle_nodes, static_cast<bvh_node*>(nullptr)) };
+        const auto mats = view_of(material_records, static_cast<material_record*>(nullptr));
+        const auto light_recs = view_of(light_records, static_cast<light_record*>(nullptr));
+        const auto deps = view_of(dependency_records, static_cast<dependency_record*>(nullptr));
+        const auto paths = view_of(dependency_paths, static_cast<char*>(nullptr));
+        if (!fits) return nullptr;
+
+        // a rebuilt obj file makes the cache stale even when the scene text is the same
+        for (const auto& d : deps) {
+            if (d.path_offset > paths.size() || d.path_length > paths.size() - d.path_offset) return nullptr;
+            auto dep = std::string(paths.data() + d.path_offset, static_cast<size_t>(d.path_length));
+            uint64_t size;
+            int64_t modified;
+            if (!file_stamp(dep, size, modified) || size != d.size || modified != d.modified) {
+                std::cout << dep << " changed" << std::endl;
+                return nullptr;
+            }
+        }
+
+        const auto primitives = sp.size() + t.size();
+        for (auto m : sp.mat) fits = fits && m < mats.size();
+        for (auto m : t.mat) fits = fits && m < mats.size();
+        // the kernels trust these sizes
+        auto all = [](size_t n, std::initializer_list<size_t> sizes) {
+            return std::all_of(sizes.begin(), sizes.end(), [n](size_t s) { return s == n; });
+        };
+        const auto floats = { t.e1x.size(), t.e1y.size(), t.e1z.size(), t.e2x.size(), t.e2y.size(), t.e2z.size() };
+        const auto halves = { t.e1xh.size(), t.e1yh.size(), t.e1zh.size(), t.e2xh.size(), t.e2yh.size(), t.e2zh.size() };
+        const auto edges = t.half_edges()
+            ? all(0, floats) && all(t.size() + triangle_soa::half_padding, halves)
+            : all(t.size(), floats) && all(0, halves);
+        if (!fits || !edges || primitives == 0
+            || !nodes_fit(sphere_bvh.nodes, sp.size()) || !nodes_fit(triangle_bvh.nodes, t.size())
+            || !all(sp.size(), { sp.cx.size(), sp.cy.size(), sp.cz.size(), sp.mat.size() })
+            || !all(t.size(), { t.ax.size(), t.ay.size(), t.az.size(), t.n.size() }))
+            return nullptr;
+
+        auto materials = std::vector<material>();
+        for (const auto& m : mats) {
+            materials.push_back(material{ m.alpha, { m.ambient[0], m.ambient[1], m.ambient[2] }, { m.diff[0], m.diff[1], m.diff[2] },
+                { m.spec[0], m.spec[1], m.spec[2] }, m.n, m.r });
+        }
+        auto lights = std::vector<light>();
+        for (const auto& l : light_recs) {
+            lights.push_back(light{ to_pos(l.pos), rgb{ l.color[0], l.color[1], l.color[2] } });
+        }
+
+        view.resolution = genvec::ivec2{ header.resolution[0], header.resolution[1] };
+        view.eye = to_pos(header.eye);
+        view.target = to_pos(header.target);
+        view.up = to_pos(header.up);
+
+        std::cout << "scene cache: mapped " << file->size() / 1e6 << " MB of " << path << std::endl;
+        return std::make_unique<scene>(std::move(materials), std::move(lights), std::move(sp), std::move(t),
+            std::move(sphere_bvh), std::move(triangle_bvh), false, kernels, std::shared_ptr<const void>(file));
+    }
+}
+
+std::unique_ptr<scene> open_scene(const char* path, bool brute_force, bool half_edges, const intersect_kernels& kernels, scene_view& view)
+{
+    auto file = std::ifstream(path, std::ios::binary);
+    if (!file) {
+        std::cout << "could not open " << path << std::endl;
+        return nullptr;
+    }
+    auto buffer = std::stringstream();
+    buffer << file.rdbuf();
+    const auto text = buffer.str();
+
+    const auto cache_path = std::string(path) + ".cache";
+    auto key = hash_bytes(text.data(), text.size());
+    key = hash_bytes(&cache_version, sizeof(cache_version), key);
+    key = hash_bytes(&half_edges, sizeof(half_edges), key);
+    if (!brute_force) {
+        if (auto s = map_cache(cache_path, key, kernels, view))
+            return s;
+    }
+
+    auto objects = std::vector<std::shared_ptr<object>>();
+    auto lights = std::vector<light>();
+    auto meshes = std::vector<mesh_reference>();
+    auto error = std::string();
+    view = scene_view{};
+    if (!parse_scene(text, directory_of(path), objects, lights, view, meshes, error)) {
+        std::cout << path << ": " << error << std::endl;
+        return nullptr;
+    }
+    for (const auto& ref : meshes) {
+        auto m = std::make_shared<mesh>(ref.mat);
+        auto stats = obj_stats{};
+        if (!load_obj(ref.path.c_str(), *m, stats)) return nullptr;
+        print_obj_stats(std::cout, stats, *m);
+        if (ref.fit) m->fit(ref.box);
+        objects.push_back(m);
+    }
+
+    auto s = std::make_unique<scene>(objects, std::move(lights), brute_force, kernels);
+    if (!s->materials_fit()) {
+        std::cout << path << ": more than 65536 distinct materials" << std::endl;
+        return nullptr;
+    }
+    if (half_edges) s->store_half_edges();
+    if (!brute_force) {
+        if (write_cache(cache_path, key, *s, view, meshes))
+            std::cout << "scene cache: wrote " << cache_path << std::endl;
+        else
+            std::cout << "scene cache: could not write " << cache_path << std::endl;
+    }
+    return s;
+}
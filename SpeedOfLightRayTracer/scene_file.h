@@ -0,0 +1,47 @@
+#pragma once
+#include "genvec.h"
+#include "scene.h"
+#include "objects.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// What a scene file describes besides the geometry: the image size and
+// the camera, as camera::reposition takes it. The defaults are the
+// built-in room's.
+struct scene_view
+{
+    genvec::ivec2 resolution = genvec::ivec2{ 1000, 1000 };
+    pos eye = pos{ -4.999f, .001f, .001f };
+    pos target = pos{ .001f, -.01f, -.001f };
+    fvec3 up = fvec3{ 0, 1, 0 };
+};
+
+// Scene files are text, one statement a line, # starts a comment:
+//
+//   resolution  width height
+//   camera      eye_x eye_y eye_z  target_x target_y target_z  up_x up_y up_z
+//   material    name alpha  ambient_rgb  diffuse_rgb  specular_rgb  n r
+//   light       x y z  r g b
+//   sphere      x y z radius [material]
+//   triangle    a_xyz b_xyz c_xyz [material]
+//   plane       a_xyz b_xyz c_xyz d_xyz [material]
+//   obj         path [material] [fit lo_xyz hi_xyz]
+//
+// Materials red, green, blue and white are predefined, white is the
+// default. obj paths are relative to the scene file, and fit scales the
+// mesh into the box (see mesh::fit).
+//
+// A scene is opened through a compiled cache next to it, <path>.cache,
+// holding everything the renderer needs: the view, materials, lights and
+// the flattened primitive arrays together with their bvhs, each aligned
+// for direct use. A cache whose key matches is mapped into memory and the
+// scene's arrays view it in place, so starting up parses nothing and
+// allocates nothing per primitive. The key is a hash of the scene text,
+// the bvh leaf width and whether the edges are halves (see
+// scene::store_half_edges); the size and modification time of every obj
+// file is stored too. Any difference, or a missing or damaged cache, and
+// the scene is parsed, built and the cache written again. Brute force
+// scenes have no bvhs and skip the cache. Null, with a message, when the
+// scene cannot be read.
+std::unique_ptr<scene> open_scene(const char* path, bool brute_force, bool half_edges, const intersect_kernels& kernels, scene_view& view);
@@ -0,0 +1,130 @@
+#include "stdafx.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    // position of step d along the Hilbert curve filling an n x n grid, n a power of two
+    void hilbert_to_xy(uint32_t n, uint32_t d, uint32_t& x, uint32_t& y) {
+        x = y = 0;
+        for (auto s = 1u; s < n; s *= 2) {
+            auto rx = 1 & (d / 2);
+            auto ry = 1 & (d ^ rx);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+            d /= 4;
+        }
+    }
+
+    int hardware_threads() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+std::vector<tile> make_tiles(const genvec::ivec2& size, int tile_size)
+{
+    const auto columns = (size[0] + tile_size - 1) / tile_size;
+    const auto rows = (size[1] + tile_size - 1) / tile_size;
+    auto n = 1u;
+    while (n < static_cast<uint32_t>(std::max(columns, rows))) n *= 2;
+
+    auto tiles = std::vector<tile>();
+    tiles.reserve(columns * rows);
+    for (auto d = 0u; d < n * n; d++) {
+        uint32_t x, y;
+        hilbert_to_xy(n, d, x, y);
+        if (x >= static_cast<uint32_t>(columns) || y >= static_cast<uint32_t>(rows)) continue;
+
+        auto x0 = static_cast<int>(x) * tile_size;
+        auto y0 = static_cast<int>(y) * tile_size;
+        tiles.push_back(tile{ x0, y0, std::min(tile_size, size[0] - x0), std::min(tile_size, size[1] - y0) });
+    }
+    return tiles;
+}
+
+tile_scheduler::tile_scheduler(const genvec::ivec2& size, int tile_size, int threads)
+    : thread_count(threads > 0 ? threads : hardware_threads())
+    , tiles(make_tiles(size, tile_size))
+    , finished(0)
+{
+    for (auto t = 0; t < thread_count; t++) {
+        queues.push_back(std::make_unique<work_queue>());
+    }
+}
+
+void tile_scheduler::start()
+{
+    finished = 0;
+    const auto count = tiles.size();
+    for (auto t = 0; t < thread_count; t++) {
+        auto& q = queues[t]->tiles;
+        q.clear();
+        for (auto i = count * t / thread_count; i < count * (t + 1) / thread_count; i++) {
+            q.push_back(static_cast<uint32_t>(i));
+        }
+    }
+}
+
+bool tile_scheduler::next(int thread, uint32_t& index)
+{
+    {
+        auto& q = *queues[thread];
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (!q.tiles.empty()) {
+            index = q.tiles.front();
+            q.tiles.pop_front();
+            return true;
+        }
+    }
+    return steal(thread, index);
+}
+
+bool tile_scheduler::steal(int thread, uint32_t& index)
+{
+    // tiles are never added once a run has started, so one empty pass over
+    // every other queue means the work is done
+    for (auto i = 1; i < thread_count; i++) {
+        auto& victim = *queues[(thread + i) % thread_count];
+        auto taken = std::deque<uint32_t>();
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            const auto half = (victim.tiles.size() + 1) / 2;
+            for (size_t k = 0; k < half; k++) {
+                taken.push_front(victim.tiles.back());
+                victim.tiles.pop_back();
+            }
+        }
+        if (taken.empty()) continue;
+
+        index = taken.front();
+        taken.pop_front();
+        auto& own = *queues[thread];
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.tiles.insert(own.tiles.end(), taken.begin(), taken.end());
+        return true;
+    }
+    return false;
+}
+
+void tile_scheduler::report()
+{
+    // same output as the old row loop: the percentage every tenth of the image
+    const auto total = static_cast<uint32_t>(tiles.size());
+    auto next_report = 0u;
+    while (true) {
+        const auto done = finished.load();
+        while (next_report <= 90 && done * 100 >= next_report * total) {
+            std::cout << next_report << std::endl;
+            next_report += 10;
+        }
+        if (done == total) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "genvec.h"
+#include "profiler.h"
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cstdint>
+
+struct tile
+{
+    int x0, y0;
+    int width, height;
+};
+
+// tiles of tile_size x tile_size (smaller along the right and bottom edges)
+// in Hilbert curve order, so consecutive tiles are neighbours on screen
+std::vector<tile> make_tiles(const genvec::ivec2& size, int tile_size);
+
+// Renders tiles on a pool of worker threads. Every worker starts with a
+// contiguous run of the Hilbert ordered tiles in its own deque and takes
+// from the front; a worker that runs dry steals half of the back of another
+// worker's deque, so neighbouring tiles mostly stay on one core. Progress is
+// an atomic tile counter; only the thread that called run prints it.
+class tile_scheduler
+{
+public:
+    // threads = 0 uses every hardware thread
+    tile_scheduler(const genvec::ivec2& size, int tile_size, int threads = 0);
+
+    // Calls work(tile, state) for every tile. Each worker makes its own
+    // state with make_state() on its stack first, that is the place for
+    // per thread samplers and scratch buffers, and hands it to
+    // finish(state) once it runs out of tiles.
+    template<typename MakeState, typename Work>
+    void run(MakeState&& make_state, Work&& work) {
+        run(make_state, work, [](auto&) {});
+    }
+
+    template<typename MakeState, typename Work, typename Finish>
+    void run(MakeState&& make_state, Work&& work, Finish&& finish) {
+        start();
+        auto workers = std::vector<std::thread>();
+        for (auto t = 0; t < thread_count; t++) {
+            workers.emplace_back([&, t]() {
+                auto state = make_state();
+                auto index = 0u;
+                while (next(t, index)) {
+                    PROFILE_SCOPE("tile", index);
+                    work(tiles[index], state);
+                    finished++;
+                }
+                finish(state);
+            });
+        }
+        if (!quiet) report();
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    const int thread_count;
+    const std::vector<tile> tiles;
+    bool quiet = false; // no progress output
+
+private:
+    struct work_queue {
+        std::mutex lock;
+        std::deque<uint32_t> tiles;
+    };
+
+    void start();
+    bool next(int thread, uint32_t& index);
+    bool steal(int thread, uint32_t& index);
+    void report();
+
+    std::vector<std::unique_ptr<work_queue>> queues;
+    std::atomic<uint32_t> finished;
+};
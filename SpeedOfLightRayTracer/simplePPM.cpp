@@ -75,6 +75,19 @@ int simplePPM_write_ppm(char const * filename, unsigned int width, unsigned int
 	return 0;
 }
 
+int simplePPM_write_pfm(char const * filename, unsigned int width, unsigned int height, unsigned int channels, float const * image)
+{
+	FILE *file;
+	file = simplePPM__sfopen(filename, "wb");
+
+	//negative scale means little endian; pfm stores the bottom row first
+	fprintf(file, "%s\n%i %i\n%s\n", channels == 3 ? "PF" : "Pf", width, height, "-1.0");
+	for (unsigned int y = height; y-- > 0;)
+		fwrite(image + (size_t)y * width * channels, sizeof(float) * channels, width, file);
+	fclose(file);
+	return 0;
+}
+
 unsigned char * simplePPM_read_ppm(char const * filename, unsigned int * width, unsigned int * height)
 {
 	FILE *file;
@@ -94,8 +107,8 @@ unsigned char * simplePPM_read_ppm(char const * filename, unsigned int * width,
 		asciiMode = 1;
 	else
 	{
-		width = 0;
-		height = 0;
+		*width = 0;
+		*height = 0;
 		printf("File is not a PPM file.\n");
 		exit(242);
 	}
@@ -122,7 +135,53 @@ unsigned char * simplePPM_read_ppm(char const * filename, unsigned int * width,
 		}
 	}
 	else
-		fread(image, 3, size, file);
+		fread(image, 1, size, file);
+	fclose(file);
+	return image;
+}
+
+float * simplePPM_read_pfm(char const * filename, unsigned int * width, unsigned int * height, unsigned int * channels)
+{
+	FILE *file;
+	file = simplePPM__sfopen(filename, "rb");
+
+	//read header
+	char magic[2];
+	magic[0] = fgetc(file);
+	magic[1] = fgetc(file);
+
+	if (strncmp(magic, "PF", 2) == 0)
+		*channels = 3;
+	else if (strncmp(magic, "Pf", 2) == 0)
+		*channels = 1;
+	else
+	{
+		printf("File is not a PFM file.\n");
+		exit(242);
+	}
+
+	*width = simplePPM__getuint(file);
+	*height = simplePPM__getuint(file);
+
+	float scale = 0;
+	if (fscanf(file, "%f", &scale) != 1 || scale >= 0)
+	{
+		printf("This PFM reader only reads little endian files.\n");
+		exit(242);
+	}
+	fgetc(file);
+
+	//bottom row first
+	int row = (*width) * (*channels);
+	float * image = (float *)malloc(sizeof(float) * row * (*height));
+	for (unsigned int y = *height; y-- > 0;)
+	{
+		if (fread(image + (size_t)y * row, sizeof(float), row, file) != (size_t)row)
+		{
+			printf("PFM file '%s' is cut short.\n", filename);
+			exit(242);
+		}
+	}
 	fclose(file);
 	return image;
 }
\ No newline at end of file
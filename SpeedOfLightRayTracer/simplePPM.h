@@ -1,4 +1,16 @@
 #pragma once
 //write ppm
 // takes a rgba*
-int simplePPM_write_ppm(char const * filename, unsigned int width, unsigned int height, unsigned char const * image);
\ No newline at end of file
+int simplePPM_write_ppm(char const * filename, unsigned int width, unsigned int height, unsigned char const * image);
+
+//read ppm, P6 or P3 with 8 bit channels
+// returns rgb bytes from malloc, the caller frees them
+unsigned char * simplePPM_read_ppm(char const * filename, unsigned int * width, unsigned int * height);
+
+//write pfm, little endian floats, rows top to bottom
+// takes channels (1 or 3) floats per pixel
+int simplePPM_write_pfm(char const * filename, unsigned int width, unsigned int height, unsigned int channels, float const * image);
+
+//read pfm written by simplePPM_write_pfm
+// returns floats from malloc, rows top to bottom, the caller frees them
+float * simplePPM_read_pfm(char const * filename, unsigned int * width, unsigned int * height, unsigned int * channels);
\ No newline at end of file
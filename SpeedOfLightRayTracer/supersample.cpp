@@ -0,0 +1,168 @@
+#include "stdafx.h"
+#include "supersample.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace {
+    // jitter offsets are drawn as one stratified set of up to this many
+    const int jitter_set = 16;
+
+    // the error estimate has to see this many samples before it trusts the
+    // variance alone
+    const int trusted_samples = 4;
+
+    struct pixel_stats {
+        rgb sum = rgb{ 0,0,0 };
+        float lum = 0;    // sum of the samples' luminance
+        float lum_sq = 0; // sum of its square
+        int n = 0;
+    };
+
+    float luminance(const rgb& c) {
+        return .2126f * c[0] + .7152f * c[1] + .0722f * c[2];
+    }
+
+    struct worker_state {
+        sampler smp;
+        ray_counts counts;
+    };
+
+    // adds count jittered samples to pixel (x, y)
+    void sample_pixel(const scene& s, camera& c, int x, int y, int count, const render_settings& settings, worker_state& w, pixel_stats& px, aux_buffers& aux, size_t pixel) {
+        auto& smp = w.smp;
+        genvec::fvec<2> jitter[jitter_set];
+        for (auto first = 0; first < count; first += jitter_set) {
+            const auto n = std::min(jitter_set, count - first);
+            const auto index = static_cast<uint64_t>(px.n);
+            smp.start_pixel(x, y, randutils::hash(index));
+            smp.start_set(n);
+            for (auto k = 0; k < n; k++) {
+                jitter[k] = smp.next();
+            }
+
+            for (auto k = 0; k < n; k++) {
+                const auto r = c.castRay(x, y, jitter[k][0], jitter[k][1]);
+                smp.start_pixel(x, y, randutils::hash(index + k, 1));
+                const auto hit = s.closest_hit(r);
+                if (px.n + k == 0)
+                    aux.record(pixel, r, hit);
+                const auto color = trace_path(s, r, hit, settings, smp, w.counts);
+                const auto l = luminance(color);
+                px.sum += color;
+                px.lum += l;
+                px.lum_sq += l * l;
+            }
+            px.n += n;
+        }
+    }
+
+    // relative standard error of the pixel's mean; floor keeps dark pixels
+    // from asking for samples nobody can see
+    float pixel_error(const std::vector<pixel_stats>& stats, const genvec::ivec2& size, int x, int y, float floor) {
+        const auto& px = stats[y*size[0] + x];
+        const auto n = static_cast<float>(px.n);
+        const auto mean = px.lum / n;
+        auto error = 0.f;
+        if (px.n > 1) {
+            const auto variance = std::max(0.f, (px.lum_sq - px.lum * mean) / (n - 1));
+            error = std::sqrt(variance / n);
+        }
+        if (px.n < trusted_samples) {
+            // too few samples to see the spread, an edge shows up as contrast
+            const int dx[] = { -1, 1, 0, 0 };
+            const int dy[] = { 0, 0, -1, 1 };
+            for (auto i = 0; i < 4; i++) {
+                const auto nx = x + dx[i], ny = y + dy[i];
+                if (nx < 0 || ny < 0 || nx >= size[0] || ny >= size[1]) continue;
+                const auto& other = stats[ny*size[0] + nx];
+                error = std::max(error, std::abs(other.lum / other.n - mean) / std::sqrt(n));
+            }
+        }
+        return error / std::max(mean, floor);
+    }
+}
+
+void render_supersampled(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed, tile_scheduler& scheduler, std::vector<rgb>& img, ray_counts& counts, aux_buffers& aux, cost_map& costs)
+{
+    const auto pixels = size[0] * size[1];
+    const auto min_samples = std::max(1, settings.pixel_samples);
+    const auto max_samples = std::max(min_samples, settings.max_pixel_samples);
+    const auto budget = (settings.sample_budget > 0)
+        ? std::max(static_cast<int64_t>(min_samples) * pixels, static_cast<int64_t>(settings.sample_budget * pixels))
+        : static_cast<int64_t>(max_samples) * pixels;
+
+    auto stats = std::vector<pixel_stats>(pixels);
+    auto want = std::vector<int>(pixels, min_samples);
+    auto spent = static_cast<int64_t>(min_samples) * pixels;
+
+    struct candidate {
+        float error;
+        int pixel;
+    };
+    auto candidates = std::vector<candidate>();
+
+    std::mutex counts_lock;
+    auto make_state = [&]() { return worker_state{ sampler{ settings.pattern, seed } }; };
+    for (auto pass = 0; ; pass++) {
+        scheduler.run(make_state, [&](const tile& t, worker_state& w) {
+            for (auto y = t.y0; y < t.y0 + t.height; ++y) {
+                for (auto x = t.x0; x < t.x0 + t.width; ++x) {
+                    const auto idx = y*size[0] + x;
+                    if (want[idx] == 0) continue;
+                    const auto from = costs.now();
+                    sample_pixel(s, c, x, y, want[idx], settings, w, stats[idx], aux, idx);
+                    costs.add(idx, from, costs.now());
+                }
+            }
+        }, [&](worker_state& w) {
+            std::lock_guard<std::mutex> guard(counts_lock);
+            counts += w.counts;
+        });
+        // only the first pass covers the whole image
+        scheduler.quiet = true;
+
+        if (spent >= budget || max_samples == min_samples) break;
+
+        auto mean = 0.;
+        for (const auto& px : stats) {
+            mean += px.lum / px.n;
+        }
+        const auto floor = std::max(1e-6f, static_cast<float>(.1 * mean / pixels));
+
+        candidates.clear();
+        for (auto y = 0; y < size[1]; y++) {
+            for (auto x = 0; x < size[0]; x++) {
+                const auto idx = y*size[0] + x;
+                want[idx] = 0;
+                if (stats[idx].n >= max_samples) continue;
+                const auto error = pixel_error(stats, size, x, y, floor);
+                if (error > settings.pixel_error)
+                    candidates.push_back(candidate{ error, idx });
+            }
+        }
+        if (candidates.empty()) break;
+
+        // worst first, each doubles its samples while the budget lasts
+        std::sort(candidates.begin(), candidates.end(), [](const candidate& a, const candidate& b) { return a.error > b.error; });
+        auto chosen = 0;
+        for (const auto& cand : candidates) {
+            const auto n = stats[cand.pixel].n;
+            const auto more = static_cast<int>(std::min<int64_t>(std::min(n, max_samples - n), budget - spent));
+            if (more <= 0) break;
+            want[cand.pixel] = more;
+            spent += more;
+            chosen++;
+        }
+        std::cout << "pass " << pass + 1 << ": " << chosen << " pixels above error " << settings.pixel_error << std::endl;
+    }
+
+    auto most = 0;
+    for (auto i = 0; i < pixels; i++) {
+        img[i] = stats[i].sum / static_cast<float>(stats[i].n);
+        most = std::max(most, stats[i].n);
+    }
+    std::cout << "samples per pixel: " << static_cast<double>(spent) / pixels << " average, " << most << " most" << std::endl;
+    scheduler.quiet = false;
+}
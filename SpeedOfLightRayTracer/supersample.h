@@ -0,0 +1,25 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "scene.h"
+#include "render_settings.h"
+#include "scheduler.h"
+#include "integrator.h"
+#include "denoise.h"
+#include "heatmap.h"
+#include <vector>
+#include <cstdint>
+
+using genvec::rgb;
+
+// Adaptive supersampling on top of trace_path. Every pixel first gets
+// settings.pixel_samples rays jittered inside the pixel. After each pass
+// the error of every pixel is estimated from the spread of its samples'
+// luminance (and, while a pixel has fewer than four samples, from the
+// contrast with its neighbours), relative to the pixel's brightness. The
+// pixels above settings.pixel_error double their sample count, worst first,
+// until none is left, all reached max_pixel_samples or the sample budget is
+// spent. img receives the mean of each pixel's samples, counts the rays,
+// aux what the first sample of each pixel hit and costs what its samples
+// cost.
+void render_supersampled(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed, tile_scheduler& scheduler, std::vector<rgb>& img, ray_counts& counts, aux_buffers& aux, cost_map& costs);
@@ -0,0 +1,305 @@
+#include "stdafx.h"
+#include "wavefront.h"
+#include "sampler.h"
+#include "profiler.h"
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cmath>
+
+using genvec::dot;
+
+namespace {
+    // pixels per wave; the first shadow queue of a wave holds
+    // wave_size * lights * shadow_samples rays
+    const int wave_size = 4096;
+
+    struct path {
+        pos e;
+        fvec3 dir;
+        rgb weight; // product of the reflectances so far, what the roulette looks at
+        float share; // of the pixel, 1 / the reflection samples the path split into
+        uint32_t pixel;
+        uint64_t stream; // tells the reflection samples of one pixel apart
+    };
+
+    struct shadow_ray {
+        pos e;
+        fvec3 dir;
+        rgb contribution; // added to the pixel when the light is visible
+        float dist;
+        uint32_t pixel;
+    };
+
+    // spreads the low 10 bits of v out to every third bit
+    uint32_t spread_bits(uint32_t v) {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    // 30 bit sort key: Morton code of the origin inside the scene bounds at
+    // 8 bits per axis, then a 2 bit per axis Morton code of the direction
+    class morton_key
+    {
+    public:
+        explicit morton_key(const aabb& box) : lo(box.lo) {
+            for (auto i = 0; i < 3; i++) {
+                auto extent = box.empty() ? 0.f : box.hi[i] - box.lo[i];
+                scale[i] = extent > 0 ? 256 / extent : 0;
+            }
+        }
+
+        uint32_t operator()(const pos& e, const fvec3& dir) const {
+            uint32_t o[3], d[3];
+            for (auto i = 0; i < 3; i++) {
+                o[i] = static_cast<uint32_t>(std::min(255.f, std::max(0.f, (e[i] - lo[i]) * scale[i])));
+                d[i] = static_cast<uint32_t>(std::min(3.f, std::max(0.f, (dir[i] + 1) * 2)));
+            }
+            auto origin = spread_bits(o[0]) | (spread_bits(o[1]) << 1) | (spread_bits(o[2]) << 2);
+            auto direction = spread_bits(d[0]) | (spread_bits(d[1]) << 1) | (spread_bits(d[2]) << 2);
+            return (origin << 6) | direction;
+        }
+
+    private:
+        pos lo;
+        float scale[3];
+    };
+
+    // trace_path's termination for the colour weight of a path: false when
+    // the path stops, otherwise the survivors of a roulette round come back
+    // reweighted
+    bool survives(rgb& weight, const render_settings& settings, sampler& smp) {
+        const auto throughput = std::max(weight[0], std::max(weight[1], weight[2]));
+        if (throughput < settings.throughput_cutoff)
+            return false;
+        if (throughput >= settings.roulette_weight)
+            return true;
+
+        smp.start_set(1);
+        if (smp.next()[0] * settings.roulette_weight >= throughput)
+            return false;
+        weight = weight * (settings.roulette_weight / throughput);
+        return true;
+    }
+
+    // stable LSD radix sort, returns the indices of keys in sorted order
+    void sort_order(const std::vector<uint32_t>& keys, std::vector<uint32_t>& order, std::vector<uint32_t>& tmp) {
+        order.resize(keys.size());
+        tmp.resize(keys.size());
+        std::iota(order.begin(), order.end(), 0);
+        for (auto shift = 0; shift < 32; shift += 8) {
+            size_t count[257] = {};
+            for (auto i : order) count[((keys[i] >> shift) & 0xff) + 1]++;
+            for (auto b = 0; b < 256; b++) count[b + 1] += count[b];
+            for (auto i : order) tmp[count[(keys[i] >> shift) & 0xff]++] = i;
+            order.swap(tmp);
+        }
+    }
+
+    // the sort's buffers, kept from wave to wave
+    struct sort_buffers {
+        std::vector<uint32_t> keys, order, tmp;
+    };
+
+    // reorders a ray queue by the Morton key of its rays
+    template<typename T>
+    void sort_queue(std::vector<T>& queue, const morton_key& key, std::vector<T>& scratch, sort_buffers& buffers) {
+        const auto n = static_cast<int>(queue.size());
+        auto& keys = buffers.keys;
+        keys.resize(n);
+#pragma omp parallel for schedule(static)
+        for (auto i = 0; i < n; i++) {
+            keys[i] = key(queue[i].e, queue[i].dir);
+        }
+
+        sort_order(keys, buffers.order, buffers.tmp);
+
+        scratch.clear();
+        scratch.reserve(n);
+        for (auto i : buffers.order) {
+            scratch.push_back(queue[i]);
+        }
+        queue.swap(scratch);
+    }
+}
+
+void render_wavefront(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed, std::vector<rgb>& img, ray_counts& counts, aux_buffers& aux)
+{
+    const auto max_depth = settings.max_depth;
+    const auto shadow_spread = settings.shadow_spread;
+    const auto pick_lights = s.lights.size() > static_cast<size_t>(settings.max_exact_lights);
+    const auto key = morton_key{ s.bounds() };
+    auto smp = sampler{ settings.pattern, seed };
+    auto paths = std::vector<path>(), next = std::vector<path>(), path_scratch = std::vector<path>();
+    auto shadows = std::vector<shadow_ray>(), shadow_scratch = std::vector<shadow_ray>();
+    auto hits = std::vector<packed_hit>();
+    auto offsets = std::vector<int>();
+    auto visible = std::vector<char>();
+    auto sort_scratch = sort_buffers{};
+
+    const auto pixels = size[0] * size[1];
+    auto next_report = 0;
+    for (auto begin = 0; begin < pixels; begin += wave_size) {
+        if (begin >= next_report) {
+            std::cout << begin*100.f / pixels << std::endl;
+            next_report += pixels / 10;
+        }
+
+        PROFILE_SCOPE("wave", begin / wave_size);
+        const auto end = std::min(pixels, begin + wave_size);
+        PROFILE_COUNT(pixel_samples, end - begin);
+        paths.clear();
+        for (auto i = begin; i < end; i++) {
+            auto r = c.castRay(i % size[0], i / size[0]);
+            paths.push_back(path{ r.e, r.dir, rgb{ 1,1,1 }, 1.f, static_cast<uint32_t>(i), 0 });
+        }
+
+        for (auto depth = 0; depth < max_depth && !paths.empty(); depth++) {
+            // extension: closest hits for the whole queue
+            sort_queue(paths, key, path_scratch, sort_scratch);
+            const auto n = static_cast<int>(paths.size());
+            counts.paths[std::min(depth, ray_counts::depths - 1)] += n;
+            if (depth == 0) PROFILE_COUNT(primary_rays, n);
+            else PROFILE_COUNT(reflection_rays, n);
+            hits.resize(n);
+            // the spans end before the barrier, so they show each thread's share
+#pragma omp parallel
+            {
+                PROFILE_SCOPE("extend", depth);
+#pragma omp for schedule(dynamic, 256) nowait
+                for (auto i = 0; i < n; i++) {
+                    hits[i] = s.closest_hit(ray{ paths[i].e, paths[i].dir });
+                }
+            }
+            if (depth == 0 && aux.enabled()) {
+                for (auto i = 0; i < n; i++) {
+                    aux.record(paths[i].pixel, ray{ paths[i].e, paths[i].dir }, hits[i].unpack());
+                }
+            }
+
+            // shading: misses, ambient and the reflection queue for the next depth
+            const auto samples = settings.shadow_samples_at(depth);
+            const auto per_hit = pick_lights ? samples : static_cast<int>(s.lights.size()) * samples;
+            offsets.resize(n + 1);
+            offsets[0] = 0;
+            next.clear();
+            for (auto i = 0; i < n; i++) {
+                const auto& p = paths[i];
+                const auto mat_ptr = hits[i].mat;
+                offsets[i + 1] = offsets[i] + (mat_ptr ? per_hit : 0);
+                if (!mat_ptr) {
+                    img[p.pixel] += p.weight * p.share * p.dir.abs();
+                    continue;
+                }
+
+                const auto& mat = *mat_ptr;
+                if (pick_lights) {
+                    img[p.pixel] += p.weight * p.share * mat.ambient.abs() * s.light_bvh.total_color;
+                }
+                else {
+                    for (const auto& light : s.lights) {
+                        img[p.pixel] += p.weight * p.share * (light.color * mat.ambient).abs();
+                    }
+                }
+
+                if (mat.r > 0 && depth + 1 < max_depth) {
+                    smp.start_pixel(p.pixel % size[0], p.pixel / size[0], randutils::hash(p.stream, 2 * depth + 1));
+                    auto weight = p.weight * mat.r;
+                    if (!survives(weight, settings, smp))
+                        continue;
+
+                    const auto norm = hits[i].unpack().second.n;
+                    auto pos_of_intersect = p.e + hits[i].d * p.dir;
+                    auto reflect_dir = (p.dir - 2 * dot(p.dir, norm)*norm).normalized();
+                    // only the first surface splits into several reflection rays
+                    const auto branches = (depth == 0) ? settings.reflection_samples : 1;
+                    smp.start_set(branches);
+                    for (auto j = 0; j < branches; j++) {
+                        auto u = smp.next();
+                        auto wiggle = (branches > 1) ? sphere_direction(u[0], u[1]) : fvec3{ 0,0,0 };
+                        auto dir = (reflect_dir * settings.reflection_spread + wiggle).normalized();
+                        auto stream = (branches > 1) ? randutils::hash(p.stream, j + 1) : p.stream;
+                        next.push_back(path{ pos_of_intersect + (norm * .001f), dir, weight, p.share / branches, p.pixel, stream });
+                    }
+                }
+            }
+
+            // shadow rays, the same terms as trace_path
+            shadows.resize(offsets[n]);
+#pragma omp parallel for schedule(dynamic, 64)
+            for (auto i = 0; i < n; i++) {
+                if (!hits[i].mat) continue;
+                const auto& p = paths[i];
+                auto local = sampler{ settings.pattern, seed };
+                local.start_pixel(p.pixel % size[0], p.pixel / size[0], randutils::hash(p.stream, 2 * depth));
+                const auto hit = hits[i].unpack();
+                const auto& mat = *hit.first;
+                const auto& norm = hit.second.n;
+                const auto pos_of_intersect = p.e + hit.second.d * p.dir;
+
+                auto out = offsets[i];
+                if (pick_lights) {
+                    // one light per ray from the light tree, as trace_path does
+                    local.start_set(samples);
+                    for (auto j = 0; j < samples; j++) {
+                        auto u = local.next();
+                        uint32_t index;
+                        float pdf;
+                        auto sr = shadow_ray{ pos_of_intersect, norm, rgb{ 0,0,0 }, 0, p.pixel };
+                        if (s.light_bvh.pick(pos_of_intersect, norm, u[0], index, pdf)) {
+                            const auto& light = s.lights[index];
+                            auto l = (light.pos - pos_of_intersect).normalized();
+                            auto wiggle = (samples > 1) ? sphere_direction(u[0], u[1]) : fvec3{ 0,0,0 };
+                            sr = shadow_ray{ pos_of_intersect + (norm * .001f), (l * shadow_spread + wiggle).normalized(), p.weight * p.share * lit_by(light, pos_of_intersect, norm, p.dir, mat) / (pdf * samples), (light.pos - pos_of_intersect).len(), p.pixel };
+                        }
+                        shadows[out++] = sr;
+                    }
+                    continue;
+                }
+                for (const auto& light : s.lights) {
+                    auto dist_to_light = (light.pos - pos_of_intersect).len();
+                    auto l = (light.pos - pos_of_intersect).normalized();
+                    auto contribution = p.weight * p.share * lit_by(light, pos_of_intersect, norm, p.dir, mat) / samples;
+
+                    local.start_set(samples);
+                    for (auto j = 0; j < samples; j++) {
+                        auto u = local.next();
+                        auto wiggle = (samples > 1) ? sphere_direction(u[0], u[1]) : fvec3{ 0,0,0 };
+                        shadows[out++] = shadow_ray{ pos_of_intersect + (norm * .001f), (l * shadow_spread + wiggle).normalized(), contribution, dist_to_light, p.pixel };
+                    }
+                }
+            }
+
+            // shadow queue: visibility in a batch, then accumulate
+            sort_queue(shadows, key, shadow_scratch, sort_scratch);
+            const auto m = static_cast<int>(shadows.size());
+            visible.resize(m);
+            auto traced = 0;
+#pragma omp parallel
+            {
+                PROFILE_SCOPE("shadow", depth);
+#pragma omp for schedule(dynamic, 1024) nowait
+                for (auto i = 0; i < m; i++) {
+                    const auto& sr = shadows[i];
+                    // lights behind the surface add nothing, no need to trace them
+                    const auto zero = sr.contribution[0] == 0 && sr.contribution[1] == 0 && sr.contribution[2] == 0;
+                    visible[i] = !zero && !s.occluded(ray{ sr.e, sr.dir }, sr.dist);
+                }
+            }
+            for (auto i = 0; i < m; i++) {
+                const auto& sr = shadows[i];
+                traced += !(sr.contribution[0] == 0 && sr.contribution[1] == 0 && sr.contribution[2] == 0);
+                if (visible[i])
+                    img[shadows[i].pixel] += shadows[i].contribution;
+            }
+
+            counts.shadows[std::min(depth, ray_counts::depths - 1)] += traced;
+            PROFILE_COUNT(shadow_rays, traced);
+            paths.swap(next);
+        }
+    }
+}
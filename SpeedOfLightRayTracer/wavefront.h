@@ -0,0 +1,19 @@
+#pragma once
+#include "genvec.h"
+#include "camera.h"
+#include "scene.h"
+#include "render_settings.h"
+#include "integrator.h"
+#include "denoise.h"
+#include <vector>
+#include <cstdint>
+
+using genvec::rgb;
+
+// Breadth-first alternative to trace_path. Pixels are processed in
+// waves: all rays of one kind and depth go into a queue, the queue is sorted
+// by a Morton code of origin and direction, traced as one batch, and the
+// results are added straight into img. Produces the same image as
+// trace_path up to sampling noise, including the roulette; counts receives
+// the size of every queue, aux what the camera rays hit.
+void render_wavefront(const scene& s, camera& c, const genvec::ivec2& size, const render_settings& settings, uint64_t seed, std::vector<rgb>& img, ray_counts& counts, aux_buffers& aux);